@@ -11,26 +11,31 @@
 void menu() {
     printf("Menu*********************************\n");
     printf("Enter s to submit a file\n");
+    printf("Enter c to convert a program file to a binary image\n");
+    printf("Enter i to dump the program image cache\n");
     printf("Enter x to execute a file\n");
     printf("Enter y to execute multiple cycles\n");
-    printf("Enter q to view ready queue and endWait queue\n");
+    printf("Enter g to run the cpu continuously, z to pause it\n");
+    printf("Enter q to view ready, endWait and suspended queues\n");
     printf("Enter r to dump current running process registers\n");
     printf("Enter p to dump PCB information for submitted processes\n");
     // printf("Enter b to dump page tables for submitted processes\n");
     printf("Enter m to dump memory content for submitted process\n");
     printf("Enter n to dump main memory contents\n");
     printf("Enter f to dump frame metadata for submitted processes\n");
+    printf("Enter R to dump page replacement statistics, O to change the policy\n");
     printf("Enter e to dump events\n");
     printf("Enter d to dump disk contents\n");
-    printf("Enter w to dump swap queue\n");
+    printf("Enter P, M or D to continue the p, m or d dump from a pid\n");
+    printf("Enter w to dump swap queue, Z the compressed swap pool\n");
     printf("Enter T to terminate\n");
 
 }
 
 void process_admin_command ()
 { char action[10];
-  char fname[100];
-  int round, i;
+  char fname[100], image[100];
+  int round, from, policy;
 
   while (systemActive)
   { printf ("command> ");
@@ -42,30 +47,55 @@ void process_admin_command ()
         menu(); break;
       case 's':  // submit
         one_submission (); break;
-      case 'x':  // execute
-        execute_process (); break;
+      case 'i':   // dump the program image cache in loader.c
+        dump_image_cache (); break;
+      case 'c':  // convert a text program to a binary program image
+        printf ("Program to convert: ");
+        scanf ("%s", fname);
+        printf ("Image file: ");
+        scanf ("%s", image);
+        convert_program (fname, image); break;
+      case 'x':  // execute one round on the cpu thread
+        cpu_step (1); break;
       case 'y':  // multiple rounds of execution
         printf ("Iterative execution: #rounds? ");
         scanf ("%d", &round);
-        for (i=0; i<round; i++)
-        { execute_process();
-          if (Debug) { dump_memoryframe_info(); dump_PCB_memory(); }
-        }
+        cpu_step (round);
         break;
+      case 'g':  // let the cpu run continuously
+        cpu_run (); break;
+      case 'z':  // pause the cpu
+        cpu_pause (); break;
       case 'q':  // dump ready queue and list of processes completed IO
         dump_ready_queue ();
         dump_endWait_list ();
+        dump_suspended_list ();
+        dump_submission_queue ();
         break;
       case 'r':   // dump the registers
         dump_registers (); break;
       case 'p':   // dump the list of available PCBs
-        dump_PCB_list (); break;
+        dump_PCB_list (idlePid); break;
+      case 'P':   // dump the PCBs from a given pid on
+        printf ("From pid? ");
+        scanf ("%d", &from);
+        dump_PCB_list (from); break;
       case 'm':   // dump memory of each process
-        dump_PCB_memory (); break;
+        dump_PCB_memory (idlePid); break;
+      case 'M':   // dump memory of the processes from a given pid on
+        printf ("From pid? ");
+        scanf ("%d", &from);
+        dump_PCB_memory (from); break;
       case 'f':   // dump memory frames and free frame list
         dump_memoryframe_info ();
 		    dump_free_list();
 		    break;
+      case 'R':   // dump the page replacement statistics
+        dump_replacement_info (); break;
+      case 'O':   // change the page replacement policy
+        printf ("Policy (0 clock, 1 aging, 2 lru, 3 2q)? ");
+        scanf ("%d", &policy);
+        set_replacement_policy (policy); break;
       case 'n':   // dump the content of the entire memory
         dump_memory (); break;
       case 'e':   // dump events in clock.c
@@ -74,8 +104,14 @@ void process_admin_command ()
         dump_termio_queue (); break;
       case 'w':   // dump swap queue
         dump_swapQ (); break;
+      case 'Z':   // dump the compressed swap pool
+        dump_zswap (); break;
 	    case 'd':
-		    dump_swap(); break;//dump swap.disk
+		    dump_swap(idlePid+1); break;//dump swap.disk
+      case 'D':   // dump swap.disk of the processes from a given pid on
+        printf ("From pid? ");
+        scanf ("%d", &from);
+        dump_swap (from); break;
       case 'T':  // Terminate, do nothing, terminate in while loop
         systemActive = 0; break;
       default:   // can be used to yield to client submission input
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <semaphore.h>
 #include "simos.h"
 
 #define maxCPUcycles 1024*1024*1024 // = 2^30
 
 void check_timer ();
+void insert_event ();
 
 void advance_clock ()
 { CPU.numCycles++;
@@ -21,13 +23,15 @@ void advance_clock ()
 // We need to build a timer list, in sorted order
 // only the first event in the list will be checked to see 
 // whether its time is up
-// To make insertion efficient, we keep a binary tree of events
-// while using a eventHead pointer to point to the leftmost node 
+// To make insertion efficient, we keep a binary min-heap of events,
+// eventHeap[0] is the head (the earliest event).  A plain binary tree
+// degenerates to a list because timers are mostly added in time order,
+// the heap keeps insertion and removal O(log n) with many processes
 //
-// eventNode is defined to keep track of timer events and 
-// to maintain the event tree (and list)
+// eventNode is defined to keep track of timer events
 // The fields: time, pid, act, recurP belong to the timer event level
-// The fields: left, right, parent belong to the tree data structure level
+// The field: seq belongs to the heap, it keeps events with the same
+// time in insertion order
 
 struct eventNode
 { int time;   // in number of instruction cycles, relative to absolute time
@@ -36,95 +40,110 @@ struct eventNode
   int act;    // action to be performed when timer expires
   int recurP; // if it is not a recurring timer, then this is 0; 
               // else this is the recurring period
-  struct eventNode *left, *right;
-  struct eventNode *parent;
-              // keep parent node to make removal of head node easier
-} *eventTree, *eventHead;
+  unsigned seq;
+};
 
+struct eventNode **eventHeap;
+int numEvents = 0;
+int heapSize = 0;
+unsigned eventSeq = 0;
 
-// the event tree has a dummy node to begin with, with the highest time
+// timers are added by the cpu thread and the swap thread, and dumped by
+// the admin thread, so the heap is protected
+sem_t tmutex;
+
+#define eventHead eventHeap[0]
+
+// is event a due before event b
+int event_before (struct eventNode *a, struct eventNode *b)
+{ if (a->time != b->time) return (a->time < b->time);
+  return (a->seq < b->seq);
+}
+
+void swap_events (int i, int j)
+{ struct eventNode *temp;
+
+  temp = eventHeap[i];  eventHeap[i] = eventHeap[j];  eventHeap[j] = temp;
+}
+
+// the heap has a dummy event to begin with, with the highest time,
+// so that it is never empty
 void initialize_eventtree ()
-{ 
-  eventTree = (struct eventNode *) malloc (sizeof (struct eventNode));
-  eventTree->time = maxCPUcycles + 1;
-  eventTree->pid = 0;
-  eventTree->act = 0;
-  eventTree->recurP = 0;
-  eventTree->left = NULL;
-  eventTree->right = NULL;
-  eventTree->parent = NULL; 
-  eventHead = eventTree;
+{ struct eventNode *dummy;
+
+  heapSize = 64;
+  eventHeap = (struct eventNode **)
+              malloc (heapSize * sizeof (struct eventNode *));
+  numEvents = 0;
+  dummy = (struct eventNode *) malloc (sizeof (struct eventNode));
+  dummy->time = maxCPUcycles + 1;
+  dummy->pid = 0;
+  dummy->act = 0;
+  dummy->recurP = 0;
+  insert_event (dummy);
 }
 
 void insert_event (event)
 struct eventNode *event;
-{ struct eventNode *cnode;
-
-  event->left = NULL;
-  event->right = NULL;
-  
-  cnode = eventTree;
-  while (cnode != NULL)
-  { if (event->time < cnode->time) 
-      if (cnode->left == NULL)
-      { cnode->left = event;
-        event->parent = cnode;
-        if (eventHead == cnode) eventHead = event;
-         // the new event has a lower time, eventHead should point to it
-        break;
-      }
-      else cnode = cnode->left;
-    else // event->time >= tree->time
-    { if (cnode->right == NULL)
-      { cnode->right = event;
-        event->parent = cnode;
-        break;
-      }
-      else cnode = cnode->right;
-    }
+{ int i, parent;
+
+  if (numEvents == heapSize)
+  { heapSize = heapSize * 2;
+    eventHeap = (struct eventNode **)
+                realloc (eventHeap, heapSize * sizeof (struct eventNode *));
+  }
+  event->seq = eventSeq++;
+  i = numEvents++;
+  eventHeap[i] = event;
+  while (i > 0)
+  { parent = (i - 1) / 2;
+    if (!event_before (eventHeap[i], eventHeap[parent])) break;
+    swap_events (i, parent);
+    i = parent;
   }
 }
 
-// only remove the eventHead, which is always leftmost node in the tree
-// first update the eventHead, then update the tree
+// only remove the eventHead, move the last event to the top and sift down
 // note: freeing the node is not done here, recurring event reuses node 
 
 void remove_eventhead ()
-{ struct eventNode *event, *temp;
-
-  event = eventHead;
-  if (event->right != NULL)
-  { temp = event->right;
-    while (temp->left != NULL) temp = temp->left;
-    eventHead = temp;
-    event->right->parent = event->parent;
+{ int i, child;
+
+  numEvents--;
+  eventHeap[0] = eventHeap[numEvents];
+  i = 0;
+  while ((child = 2 * i + 1) < numEvents)
+  { if (child + 1 < numEvents &&
+        event_before (eventHeap[child+1], eventHeap[child])) child++;
+    if (!event_before (eventHeap[child], eventHeap[i])) break;
+    swap_events (i, child);
+    i = child;
   }
-  else eventHead = event->parent;
-  event->parent->left = event->right;
 }
 
-// recursive call to list all events in the event tree
-// external  caller should call dump_events()
-void list_events (event)
-struct eventNode *event;
-{
-  if (event != NULL)
-  { printf ("Event: time=%d, pid=%d, action=%d, recurP=%d, ",
+// list all events in heap order
+void list_events ()
+{ int i;
+  struct eventNode *event;
+
+  for (i=0; i<numEvents; i++)
+  { event = eventHeap[i];
+    printf ("Event: time=%d, pid=%d, action=%d, recurP=%d\n",
              event->time, event->pid, event->act, event->recurP);
-    if (event->left != NULL) printf ("left=%d, ", event->left->time);
-    else printf ("left=null, ");
-    if (event->right != NULL) printf ("right=%d\n", event->right->time);
-    else printf ("right=null\n");
-    list_events (event->left);
-    list_events (event->right);
   }
 }
 
-void dump_events ()
+void print_events ()
 { printf ("Now = %d, Head: time=%d, pid=%d, action=%d, recurP=%d\n",
            CPU.numCycles, eventHead->time,
            eventHead->pid, eventHead->act, eventHead->recurP);
-  list_events (eventTree);
+  list_events ();
+}
+
+void dump_events ()
+{ sem_wait (&tmutex);
+  print_events ();
+  sem_post (&tmutex);
 }
 
 
@@ -134,6 +153,7 @@ void dump_events ()
 
 void initialize_timer ()
 { 
+  sem_init (&tmutex, 0, 1);
   initialize_eventtree();
 }
 
@@ -151,7 +171,9 @@ int time, pid, action, recurperiod; // time is from current time
     event->pid = pid;
     event->act = action;
     event->recurP = recurperiod;
+    sem_wait (&tmutex);
     insert_event (event);
+    sem_post (&tmutex);
     if (Debug) printf ("Add timer: time=%d, pid=%d, action=%d, recurP=%d\n",
                        event->time, event->pid, event->act, event->recurP);
     return ((genericPtr) event);
@@ -162,6 +184,7 @@ int time, pid, action, recurperiod; // time is from current time
 void check_timer ()
 { struct eventNode *event;
 
+  sem_wait (&tmutex);
   while (eventHead->time <= CPU.numCycles)
   { event = eventHead;
     if (clockDebug)
@@ -196,9 +219,12 @@ void check_timer ()
       { printf ("timer exceeds CPU cycle limit!!!\n"); exit(-1); }
       else insert_event (event);
     }
+    else if (event->recurP == ownedTimer)
+      event->act = actFired;   // the owner still holds it, it frees it
     else free (event);
-    if (clockDebug) { printf (" %x\n", CPU.interruptV); dump_events (); }
+    if (clockDebug) { printf (" %x\n", CPU.interruptV); print_events (); }
   }
+  sem_post (&tmutex);
 }
 
 // deactivate event set the after-event-action to NULL, we could remove it,
@@ -206,12 +232,22 @@ void check_timer ()
 // we uses eventNode ptr to get to the target event node
 // but the event node may have just been freed, a risk!!!
 //   (when cpu execution terminates for various reasons and timer is also up)
+// so a timer that is deactivated should be an ownedTimer: check_timer
+// does not free it when it expires, it is freed here instead
 void deactivate_timer (castedevent)
 genericPtr castedevent;
 { struct eventNode *event;
 
   event = (struct eventNode *) castedevent;
+  sem_wait (&tmutex);
+  if (event->act == actFired)
+  { sem_post (&tmutex);
+    free (event);
+    return;
+  }
   event->act = actNull;
+  event->recurP = oneTimeTimer;   // check_timer frees it when it is due
+  sem_post (&tmutex);
   if (clockDebug) 
     printf("Deactivate event: addr=%x, time=%d, pid=%d, action=%d, reP=%d\n",
           castedevent, event->time, event->pid, event->act, event->recurP);
@@ -18,6 +18,7 @@
 #define OPprint 7
 #define OPsleep 8
 #define OPend 1
+#define OPfork 9   // AC: the child's pid in the parent, 0 in the child
 
 
 void initialize_cpu ()
@@ -39,15 +40,17 @@ void dump_registers ()
   printf ("cycle=%d\n", CPU.numCycles);
 }
 
+// interrupts are set by the clock, terminal and swap threads while the
+// cpu thread clears them, so the update has to be atomic
 void set_interrupt (unsigned bit)
-{ CPU.interruptV = CPU.interruptV | bit; }
+{ __sync_fetch_and_or (&CPU.interruptV, bit); }
 
 void clear_interrupt (unsigned bit)
 { 
   unsigned negbit = -bit - 1;
-  printf ("IV is 0x%x, ", CPU.interruptV);
-  CPU.interruptV = CPU.interruptV & negbit;
-  printf ("after clear is %x\n", CPU.interruptV);
+  if (cpuDebug) printf ("IV is 0x%x, ", CPU.interruptV);
+  __sync_fetch_and_and (&CPU.interruptV, negbit);
+  if (cpuDebug) printf ("after clear is %x\n", CPU.interruptV);
 }
 
 void handle_interrupt ()
@@ -88,15 +91,15 @@ void handle_interrupt ()
 void fetch_instruction ()
 { int mret;
   mret = get_instruction (CPU.PC);
-  if (mret == mError) {CPU.exeStatus = eError; dump_PCB_memory();}
+  if (mret == mError) {CPU.exeStatus = eError; dump_PCB_memory(idlePid);}
   else if (mret == mPFault) {
     CPU.exeStatus = ePFault;
     set_interrupt(pFaultInstruction);
   }
-  else // fetch data, but exclude OPend and OPsleep, which has no data
+  else // fetch data, but exclude OPend, OPsleep and OPfork, which has no data
        // also exclude OPstore, which stores data, not gets data
     if (CPU.IRopcode != OPend && CPU.IRopcode != OPsleep
-        && CPU.IRopcode != OPstore)
+        && CPU.IRopcode != OPfork && CPU.IRopcode != OPstore)
     { mret = get_data (CPU.IRoperand); 
       if (mret == mError) CPU.exeStatus = eError;
       else if (mret == mPFault) CPU.exeStatus = ePFault;
@@ -160,6 +163,10 @@ void execute_instruction ()
         CPU.exeStatus = eWait;
       }
       break;
+    case OPfork:
+      // a copy of the process, sharing its memory copy-on-write
+      CPU.AC = fork_process (CPU.Pid);
+      break;
     case OPend:
       // *** ADD CODE for the instruction
       // Slightly confused what needs to done here
@@ -5,17 +5,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "simos.h"
 #include <math.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <semaphore.h>
 
 // need to be consistent with paging.c: mType and constant definitions
 #define opcodeShift 24
 #define operandMask 0x00ffffff
 #define diskPage -2
 
-FILE *progFd;
-
 //==========================================
 // load program into memory and build the process, called by process.c
 // a specific pid is needed for loading, since registers are not for this pid
@@ -23,7 +26,8 @@ FILE *progFd;
 
 // load instruction to buffer
 // may return progNormal or progError (the latter, if the program is incorrect)
-int load_instruction (mType *buf, int page, int offset){ 
+// progFd is the program file, each loader thread parses its own
+int load_instruction (FILE *progFd, mType *buf, int page, int offset){ 
   int ret, opcode, operand;
   ret = fscanf (progFd, "%d %d\n", &opcode, &operand);
   if(ret < 2) {
@@ -40,7 +44,7 @@ int load_instruction (mType *buf, int page, int offset){
 }
 
 // load data to buffer (same as load instruction, but use the mData field
-int load_data (mType *buf, int page, int offset)
+int load_data (FILE *progFd, mType *buf, int page, int offset)
 { 
   int ret, data;
   
@@ -56,92 +60,512 @@ int load_data (mType *buf, int page, int offset)
   return (progNormal);
 }
 
-// load program to swap space, returns the #pages loaded
-int load_process_to_swap (int pid, char *fname, int *dataOffset)
-{ 
-  // read from program file "fname" and call load_instruction & load_data
-  // to load the program into the buffer, write the program into
-  // swap space by inserting it to swapQ
-  // update the process page table to indicate that the page is not empty
-  // and it is on disk (= diskPage)
+//==========================================
+// program images
+// A program is first turned into an image: the encoded words of all its
+// pages, padded with 0 to a whole number of pages.  The image comes from
+// parsing the text format, or from a binary image file, which is mapped
+// with mmap and needs no parsing at all.
+//
+// binary image format (all fields are 4 byte words):
+//   header: imageMagic, imageVersion, msize, numinstr, numdata, pageSize,
+//           0, 0  (imageHeaderWords words, so the words stay aligned)
+//   words:  msize encoded words (instructions as mInstr, data as mData),
+//           padded with 0 to a multiple of the pageSize in the header
+// the words do not depend on pageSize, so an image converted with one
+// pageSize can be loaded with another one
+//==========================================
+
+#define imageMagic 0x474d4953   // "SIMG" in a little endian file
+#define imageVersion 1
+#define imageHeaderWords 8
+
+struct ImageCacheStruct;
 
-  int msize, numinstr, numdata;
-  int ret, i, j, opcode, operand;
-  float data;
+typedef struct
+{ int msize, numinstr, numdata;
+  int numpages;      // #pages of the current pageSize
+  mType *words;      // numpages*pageSize words, or the mapped words
+  int nwords;        // #words available in words, the rest reads as 0
+  void *map;         // the mmap of a binary image, NULL for a text program
+  size_t mapsize;
+  struct ImageCacheStruct *cache;  // the cache entry owning words, or NULL
+} progImage;
+
+// parse a text program into image, returns progNormal or progError
+int parse_text_program (char *fname, progImage *image)
+{ int ret, i;
+  FILE *progFd;
 
   progFd = fopen(fname, "r");
   if(progFd == NULL){
     printf("Submission Error: Program name not found, incorrect program name: %s!\n", fname);
     return progError;
   }
-  ret = fscanf(progFd, "%d %d %d\n", &msize, &numinstr, &numdata);
+  ret = fscanf(progFd, "%d %d %d\n",
+               &image->msize, &image->numinstr, &image->numdata);
   // did not get all three inputs
   if(ret < 3) {
     printf("Submission failure: Invalid file, missing %d program parameters!\n", 3-ret);
+    fclose(progFd);
     return progError;
   }
   else { //*for debugging
 	  printf("finished reading parameters\n");
   }
 
-  *dataOffset = numinstr;
-
   //Pages needed needs to check for msize - 1, because if msize is 32, it should still fit on 1 page
   //And I HIGHLY doubt we will get an msize of 0, but may add check later down the line
+  image->numpages = (image->msize - 1) / pageSize + 1;
+  image->nwords = image->numpages * pageSize;
+  image->words = (mType *) malloc (image->nwords*sizeof(mType));
+  image->map = NULL;
+  image->cache = NULL;
+  for(i = 0; i < image->nwords; i++){
+    if(i < image->numinstr) ret = load_instruction(progFd, image->words, i / pageSize, i);
+    else if(i < image->msize) ret = load_data(progFd, image->words, i / pageSize, i);
+    else image->words[i].mInstr = 0;
+    if(ret == progError){
+      printf("Submission failure: %s is missing words\n", fname);
+      free(image->words);
+      fclose(progFd);
+      return progError;
+    }
+  }
+  fclose(progFd);
+  return progNormal;
+}
+
+// map a binary image, returns progNormal, progError, or nullIndex if
+// fname is not a binary image (then it should be parsed as text)
+int map_binary_program (char *fname, progImage *image)
+{ int fd, *header;
+  struct stat st;
+
+  fd = open(fname, O_RDONLY);
+  if(fd < 0) return nullIndex;
+  if(fstat(fd, &st) < 0 || st.st_size < imageHeaderWords*dataSize){
+    close(fd);
+    return nullIndex;
+  }
+  image->mapsize = st.st_size;
+  image->map = mmap(NULL, image->mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);   // the mapping stays valid
+  if(image->map == MAP_FAILED) return nullIndex;
+  header = (int *) image->map;
+  if(header[0] != imageMagic){
+    munmap(image->map, image->mapsize);
+    return nullIndex;
+  }
+  // sizes in size_t, a corrupt msize must not overflow past the check;
+  // numinstr becomes MDbase, the data follows the instructions
+  if(header[1] != imageVersion || header[2] < 1 ||
+     (size_t) header[2] > (size_t) image->mapsize / dataSize - imageHeaderWords ||
+     header[3] < 0 || header[3] > header[2] || header[4] < 0 ||
+     header[4] != header[2] - header[3]){
+    printf("Submission failure: %s is not a valid program image\n", fname);
+    munmap(image->map, image->mapsize);
+    return progError;
+  }
+  image->msize = header[2];
+  image->numinstr = header[3];
+  image->numdata = header[4];
+  image->numpages = (image->msize - 1) / pageSize + 1;
+  image->words = (mType *) (header + imageHeaderWords);
+  image->nwords = image->mapsize / dataSize - imageHeaderWords;
+  image->cache = NULL;
+  if(Debug) printf("Mapped program image %s\n", fname);
+  return progNormal;
+}
+
+//==========================================
+// program image cache
+// The same programs are submitted again and again, so their images are
+// kept, keyed by path and modification time (and size).  A hit gives the
+// cached words without opening or parsing the program.  The cache holds
+// at most imageCacheKB kilobytes, the least recently used images that
+// are not being loaded are dropped first.  imageCacheKB=0 disables it.
+//==========================================
+
+typedef struct ImageCacheStruct
+{ char *path;
+  time_t mtime;
+  off_t fsize;
+  progImage image;   // image.words is owned by the cache entry
+  int bytes;
+  int refs;          // #loads using the image right now
+  int dropped;       // no longer in the cache, free it when refs is 0
+  struct ImageCacheStruct *prev, *next;   // LRU list, head is the newest
+} ImageCacheNode;
+
+ImageCacheNode *icacheHead = NULL;
+ImageCacheNode *icacheTail = NULL;
+int icacheBytes = 0;
+int icacheHits = 0, icacheMisses = 0, icacheDrops = 0;
+sem_t icmutex;   // the loader threads in submit.c share the cache
+
+void icache_unlink (ImageCacheNode *node)
+{
+  if (node->prev != NULL) node->prev->next = node->next;
+  else icacheHead = node->next;
+  if (node->next != NULL) node->next->prev = node->prev;
+  else icacheTail = node->prev;
+  node->prev = NULL;  node->next = NULL;
+}
+
+void icache_push (ImageCacheNode *node)
+{
+  node->prev = NULL;
+  node->next = icacheHead;
+  if (icacheHead != NULL) icacheHead->prev = node;
+  else icacheTail = node;
+  icacheHead = node;
+}
+
+void icache_free (ImageCacheNode *node)
+{
+  free (node->path);
+  free (node->image.words);
+  free (node);
+}
+
+// drop least recently used images till bytes more fit in the cache
+void icache_make_room (int bytes)
+{ ImageCacheNode *node, *prev;
+
+  node = icacheTail;
+  while (node != NULL && icacheBytes + bytes > imageCacheKB*1024)
+  { prev = node->prev;
+    icache_unlink (node);
+    icacheBytes -= node->bytes;
+    icacheDrops++;
+    if (node->refs == 0) icache_free (node);
+    else node->dropped = 1;
+    node = prev;
+  }
+}
+
+ImageCacheNode *icache_lookup (char *fname, struct stat *st)
+{ ImageCacheNode *node;
+
+  for (node = icacheHead; node != NULL; node = node->next)
+    if (strcmp (node->path, fname) == 0)
+    { if (node->mtime == st->st_mtime && node->fsize == st->st_size)
+        return (node);
+      // the program has changed, the cached image is stale
+      icache_unlink (node);
+      icacheBytes -= node->bytes;
+      if (node->refs == 0) icache_free (node);
+      else node->dropped = 1;
+      return (NULL);
+    }
+  return (NULL);
+}
+
+// put a freshly built image in the cache, image then uses the cached words
+void icache_insert (char *fname, struct stat *st, progImage *image)
+{ ImageCacheNode *node;
+  int bytes = image->nwords * sizeof(mType);
+
+  if (bytes > imageCacheKB*1024) return;   // never fits, do not cache
+  icache_make_room (bytes);
+  node = (ImageCacheNode *) malloc (sizeof (ImageCacheNode));
+  node->path = strdup (fname);
+  node->mtime = st->st_mtime;
+  node->fsize = st->st_size;
+  node->image = *image;
+  if (image->map != NULL)   // keep a copy, not the mapping
+  { node->image.words = (mType *) malloc (bytes);
+    memcpy (node->image.words, image->words, bytes);
+    munmap (image->map, image->mapsize);
+    node->image.map = NULL;
+  }
+  node->bytes = bytes;
+  node->refs = 0;
+  node->dropped = 0;
+  icache_push (node);
+  icacheBytes += bytes;
+  *image = node->image;
+}
+
+void dump_image_cache ()
+{ ImageCacheNode *node;
+
+  sem_wait (&icmutex);
+  printf ("******************** Program Image Cache\n");
+  printf ("hits=%d, misses=%d, drops=%d, size=%d/%d bytes\n",
+          icacheHits, icacheMisses, icacheDrops, icacheBytes,
+          imageCacheKB*1024);
+  for (node = icacheHead; node != NULL; node = node->next)
+    printf ("%s: msize=%d, %d bytes, refs=%d\n",
+            node->path, node->image.msize, node->bytes, node->refs);
+  sem_post (&icmutex);
+}
+
+int get_program_image (char *fname, progImage *image)
+{ int ret;
+  struct stat st;
+  ImageCacheNode *node = NULL;
+
+  if (imageCacheKB > 0 && stat (fname, &st) == 0)
+  { sem_wait (&icmutex);
+    node = icache_lookup (fname, &st);
+    if (node != NULL)
+    { icacheHits++;
+      icache_unlink (node);
+      icache_push (node);
+      node->refs++;
+      *image = node->image;
+      image->cache = node;
+      image->numpages = (image->msize - 1) / pageSize + 1;
+      sem_post (&icmutex);
+      return (progNormal);
+    }
+    icacheMisses++;
+    sem_post (&icmutex);
+  }
+
+  // parsing is done outside the lock, so loaders parse in parallel
+  ret = map_binary_program(fname, image);
+  if(ret == nullIndex) ret = parse_text_program(fname, image);
+  if(ret == progNormal && imageCacheKB > 0 && stat (fname, &st) == 0)
+  { sem_wait (&icmutex);
+    icache_insert (fname, &st, image);
+    if (icacheHead != NULL && icacheHead->image.words == image->words)
+    { icacheHead->refs++;
+      image->cache = icacheHead;
+    }
+    sem_post (&icmutex);
+  }
+  return ret;
+}
+
+void release_program_image (progImage *image)
+{ ImageCacheNode *node = image->cache;
+
+  if(node != NULL){
+    sem_wait(&icmutex);
+    node->refs--;
+    if(node->dropped && node->refs == 0) icache_free(node);
+    sem_post(&icmutex);
+  }
+  else if(image->map != NULL) munmap(image->map, image->mapsize);
+  else free(image->words);
+}
+
+void initialize_loader ()
+{ sem_init (&icmutex, 0, 1);
+}
+
+// copy page page of image into buf, words beyond the image are 0
+void copy_image_page (progImage *image, int page, mType *buf)
+{ int j, w;
+
+  for(j = 0; j < pageSize; j++){
+    w = page * pageSize + j;
+    if(w < image->nwords && w < image->msize) buf[j] = image->words[w];
+    else buf[j].mInstr = 0;
+  }
+}
+
+// convert a text program to a binary image, called by admin.c
+int convert_program (char *src, char *dst)
+{ progImage image;
+  int header[imageHeaderWords];
+  FILE *fd;
+
+  if(parse_text_program(src, &image) == progError) return progError;
+  memset(header, 0, sizeof(header));
+  header[0] = imageMagic;
+  header[1] = imageVersion;
+  header[2] = image.msize;
+  header[3] = image.numinstr;
+  header[4] = image.numdata;
+  header[5] = pageSize;
+  fd = fopen(dst, "wb");
+  if(fd == NULL){
+    printf("Convert Error: cannot create %s\n", dst);
+    release_program_image(&image);
+    return progError;
+  }
+  fwrite(header, sizeof(int), imageHeaderWords, fd);
+  fwrite(image.words, sizeof(mType), image.nwords, fd);
+  fclose(fd);
+  printf("Converted %s to %s: %d words in %d pages\n",
+         src, dst, image.msize, image.numpages);
+  release_program_image(&image);
+  return progNormal;
+}
+
+int zero_page (mType *page)
+{ int i;
+
+  for (i = 0; i < pageSize; i++)
+    if (page[i].mInstr != 0) return 0;
+  return 1;
+}
+
+// load program to swap space, returns the #pages loaded
+// stage the pages of the process for swap, returns the #pages loaded
+// words gets all the pages, the first nwrite of them have to be written
+// to swap (the pages after them are all demand-zero)
+int load_process_to_swap (int pid, char *fname, int *dataOffset,
+                          mType **words, int *nwrite)
+{ 
+  // get the image of program "fname" (parse it with load_instruction &
+  // load_data, or map it) and copy its pages to words
+  // update the process page table to indicate that the page is not empty
+  // and it is pending till the image is written to swap
+  progImage image;
+  int i;
+
+  if(get_program_image(fname, &image) == progError) return progError;
+  *dataOffset = image.numinstr;
 
   // msize is the number of byte addresses we will need. pageSize=8 according to config. 
-  int pagesNeeded = (msize - 1) / pageSize + 1;
-  //int pagesNeeded = ceil((float)msize / (float)pageSize);
   int loadedPages = 0;//keep track of successfully loaded pages. in the future could have error checking with malloc
-  printf("msize is %d. pageSize is %d. Need %d pages\n", msize, pageSize, pagesNeeded);
-  int line = 0;
-  for(i = 0; i < pagesNeeded; i++){
-    mType *page = (mType *) malloc (pageSize*sizeof(mType));
-    for(j=0; j < pageSize; j++){
-      if(line < msize){
-        if(line < numinstr){
-          load_instruction(page, i, j);
-        } else {
-          load_data(page, i, j);
-        }
-		    line++;
-      }  else {
-        page[j].mInstr = 0;
-      }
-    }
-    insert_swapQ(pid, i, (unsigned *)page, actWrite, freeBuf);
+  printf("msize is %d. pageSize is %d. Need %d pages\n", image.msize, pageSize, image.numpages);
+  *words = (mType *) malloc (image.numpages*pageSize*sizeof(mType));
+  *nwrite = 0;
+  for(i = 0; i < image.numpages; i++){
+    mType *page = *words + i*pageSize;
+    copy_image_page(&image, i, page);
     loadedPages++;
+    // an all zero page past the text is demand-zero, it never needs a read
+    if(i >= image.numinstr/pageSize && zero_page(page)){
+      set_zero_page(pid, i);
+      continue;
+    }
 	  update_process_pagetable(pid, i, pendingPage);
+    *nwrite = i + 1;
   }
-  fclose(progFd);
+  release_program_image(&image);
   return loadedPages;
 }
 
-int load_pages_to_memory (int pid, int numpages)
+// bring page k of pid in, a text page resident for another process
+// running the same program is just mapped instead of read from swap
+//==========================================
+// prepaging profiles
+// while a process is in its first profileWindow cycles, the pages it
+// faults on are noted in its PCB, and so are the pages it was loaded with
+// when it first references them (paging.c mark_prepaged), a prepaged page
+// it does not use drops out of the profile.  When it completes, they are saved in "<program>.prof", and the
+// next submission of the program prepages exactly those pages instead of
+// the loadPpages guess.
+// The pages are noted in a list, a page noted again (faulted on after
+// it was evicted) is only weeded out when the profile is written.
+// profile file: #pages, then the page numbers
+//==========================================
+
+#define profSuffix ".prof"
+#define profileStart 16   // initial profile list size, doubled as needed
+
+void note_profile_page (int pid, int page)
+{ typePCB *p = PCB[pid];
+
+  if (p->profile == NULL || page < 0 || page >= maxPpages) return;
+  if (p->timeUsed >= profileWindow) return;
+  if (p->numProfile > 0 && p->profile[p->numProfile-1] == page) return;
+  if (p->numProfile == p->profileSize)
+  { p->profileSize = 2 * p->profileSize;
+    p->profile = (int *) realloc (p->profile, p->profileSize * sizeof(int));
+  }
+  p->profile[p->numProfile++] = page;
+}
+
+int compare_pages (const void *a, const void *b)
+{ return (*(const int *) a - *(const int *) b); }
+
+// written to a temporary file first, loaders may be reading the profile
+void write_profile (int pid)
+{ FILE *fprof;
+  char pname[200], tname[210];
+  int *pages = PCB[pid]->profile, i, count = 0;
+
+  if (pages == NULL) return;
+  snprintf (pname, sizeof(pname), "%s%s", PCB[pid]->progName, profSuffix);
+  snprintf (tname, sizeof(tname), "%s.%d", pname, pid);
+  qsort (pages, PCB[pid]->numProfile, sizeof(int), compare_pages);
+  for (i = 0; i < PCB[pid]->numProfile; i++)
+    if (i == 0 || pages[i] != pages[i-1]) pages[count++] = pages[i];
+  PCB[pid]->numProfile = count;
+  fprof = fopen (tname, "w");
+  if (fprof == NULL) { printf ("Cannot write profile %s\n", pname); return; }
+  fprintf (fprof, "%d\n", count);
+  for (i = 0; i < count; i++) fprintf (fprof, "%d\n", pages[i]);
+  fclose (fprof);
+  if (rename (tname, pname) < 0) perror ("Error renaming profile: ");
+}
+
+// read the profile of program fname, keep the pages that exist (< numpages)
+// and that fit in memory, returns the #pages in pages, 0 if no profile
+int read_profile (char *fname, int *pages, int numpages)
+{ FILE *fprof;
+  char pname[200];
+  int count, i, page, n = 0;
+
+  snprintf (pname, sizeof(pname), "%s%s", fname, profSuffix);
+  fprof = fopen (pname, "r");
+  if (fprof == NULL) return (0);
+  if (fscanf (fprof, "%d", &count) < 1) count = 0;
+  for (i = 0; i < count; i++)
+  { if (fscanf (fprof, "%d", &page) < 1) break;
+    if (page >= 0 && page < numpages && n < numFrames-OSpages)
+      pages[n++] = page;
+  }
+  fclose (fprof);
+  return (n);
+}
+
+// the page is put in memory from the loader's copy, no disk read
+void request_page (int pid, int k, mType *words)
+{ mType *buf;
+
+  // demand-zero pages are left to be filled on first touch
+  if(get_pagetable_entry(pid, k) == zeroPage) return;
+  if(share_text_page(pid, k)){ mark_prepaged(pid, k); return; }
+  buf = (mType *) malloc (pageSize*sizeof(mType));
+  memcpy(buf, words + k*pageSize, pageSize*sizeof(mType));
+  update_process_pagetable(pid, k, pendingPage);
+  insert_swapQ(pid, k, (unsigned *) buf, actInstall, Nothing);
+}
+
+int load_pages_to_memory (int pid, int numpages, mType *words)
 {
   // call insert_swapQ to load the pages of process pid to memory
   // #pages to load = min (loadPpages, numpage = #pages loaded to swap for pid)
-  // ask swap.c to place the process to ready queue only after the last load
+  // the process is readied by load_process, after the image write
   // do not forget to update the page table of the process
   // this function has some similarity with page fault handler
-  int k, j;
+  int k, j, n, *pages;
+
+  // a program with a profile gets exactly its early working set
+  if(PCB[pid]->profile != NULL){
+    pages = (int *) malloc (numpages*sizeof(int));
+    n = read_profile(PCB[pid]->progName, pages, numpages);
+    for(k = 0; k < n; k++)
+      request_page(pid, pages[k], words);
+    free(pages);
+    if(n > 0){
+      if(Debug) printf("Prepaging %d pages of %s from its profile\n",
+                       n, PCB[pid]->progName);
+      return progNormal;
+    }
+  }
 
   // if this is true, load everything
   if(numpages < loadPpages){
-    for(k = 0; k < numpages-1; k++){
-      update_process_pagetable(pid, k, pendingPage);
-      insert_swapQ(pid, k, NULL, actRead, Nothing); 
+    for(k = 0; k < numpages; k++){
+      request_page(pid, k, words);
     }
-    update_process_pagetable(pid, k, pendingPage);
-    insert_swapQ(pid, k, NULL, actRead, toReady); 
   } else if(loadPpages == 1){
 
   } else {
     // Load loadPpages - 1 pages of instructions
     for(k = 0; k < loadPpages-1; k++){
-      // NULL is passed for buf, since swap will have to take care of the loading into memory
-      update_process_pagetable(pid, k, pendingPage);
-      insert_swapQ(pid, k, NULL, actRead, Nothing);
+      // the page comes from words, swap does not have to read it
+      request_page(pid, k, words);
       // update appropriate page to pending
     }
 
@@ -151,11 +575,9 @@ int load_pages_to_memory (int pid, int numpages)
       j = PCB[pid]->MDbase / pageSize;
       // update last page to pending as well
       if(j <= k){
-        update_process_pagetable(pid, k, pendingPage);
-        insert_swapQ(pid, k, NULL, actRead, toReady);
+        request_page(pid, k, words);
       } else {
-        update_process_pagetable(pid, j, pendingPage);
-        insert_swapQ(pid, j, NULL, actRead, toReady);
+        request_page(pid, j, words);
       }
     }
   }
@@ -164,14 +586,38 @@ int load_pages_to_memory (int pid, int numpages)
 }
 
 int load_process (int pid, char *fname)
-{ int ret;
+{ int ret, nwrite;
   int dataOffset;
-  ret = load_process_to_swap (pid, fname, &dataOffset);   // return #pages loaded
+  struct stat st;
+  char key[200];
+  mType *words;
+
+  ret = load_process_to_swap (pid, fname, &dataOffset, &words, &nwrite);   // return #pages loaded
+  if (ret == progError) return ret;
   PCB[pid]->MDbase = dataOffset;  //It should be somewhere else, but this is the quick, dirty way of making sure it's loaded before pages load to memory
+  if (profileWindow > 0)
+  { PCB[pid]->progName = strdup (fname);
+    PCB[pid]->profileSize = profileStart;
+    PCB[pid]->profile = (int *) malloc (profileStart * sizeof(int));
+  }
   if(Debug){
     printf("%d pages inserted in swapQ\n", ret);
   }
-  if (ret != progError) load_pages_to_memory (pid, ret);
+  // processes of the same program image share the pure instruction pages
+  if (stat (fname, &st) == 0)
+  { snprintf (key, sizeof(key), "%s:%ld:%ld",
+              fname, (long) st.st_mtime, (long) st.st_size);
+    attach_text_share (pid, key, dataOffset / pageSize);
+  }
+  load_pages_to_memory (pid, ret, words);
+  // the whole image goes to swap with one write, queued after the initial
+  // pages since those are copied from words, which swap.c frees
+  if (nwrite > 0)
+    insert_swapQ_pages (pid, 0, (unsigned *) words, nwrite, actWriteImage, freeBuf);
+  else free (words);
+  // the process is readied only after the write, so that a page fault's
+  // read of a page still pending is queued behind it
+  insert_swapQ (pid, 0, NULL, actSignal, toReady);
   return ret;
 }
 
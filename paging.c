@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <semaphore.h>
+#include <pthread.h>
 #include "simos.h"
 
 // Memory definitions, including the memory itself and a page structure
@@ -21,28 +24,91 @@
 
 mType *Memory;   // The physical memory, size = pageSize*numFrames
 
+// frame ages are kept apart from FrameStruct, in the contiguous frameAge
+// array, so that the age scan shifts a 64-bit word of ages at a time;
+// ageBits (8, 16 or 32) sets the age resolution, e.g. gcc -DageBits=16
+#ifndef ageBits
+#define ageBits 8
+#endif
+#if ageBits == 32
+typedef unsigned int ageType;
+#elif ageBits == 16
+typedef unsigned short ageType;
+#elif ageBits == 8
 typedef unsigned char ageType;
+#else
+#error "ageBits must be 8, 16 or 32"
+#endif
+typedef unsigned long long ageWord;
+#define agesPerWord (int) (sizeof(ageWord) / sizeof(ageType))
+
+// a page table (other than the owner pid/page) mapping a shared frame
+typedef struct FrameMapStruct
+{ int pid, page;
+  struct FrameMapStruct *next;
+} FrameMap;
+
 typedef struct
 { int pid, page;   // the frame is allocated to process pid for page page
-  ageType age;
   char free, dirty, pinned;   // in real systems, these are bits
-  int next, prev;
+  char shared;     // notShared, sharedText (read only, see text sharing)
+                   // or sharedCOW (see copy-on-write fork)
+  char zfill;      // zero filled on first touch, has no copy in swap
+  char ref;        // referenced since the clock hand last passed
+  char ra;         // read ahead and not referenced yet
+  char pageout;    // pinned till its queued write-back is done
+  int prepaged;    // pid it was prepaged for, till that pid references it
+  int refs;        // #page tables mapping the frame
+  int group;       // text share group of a sharedText frame
+  FrameMap *sharers;   // the other page tables mapping the frame
 } FrameStruct;
 
 FrameStruct *memFrame;   // memFrame[numFrames]
-int freeFhead, freeFtail;   // the head and tail of free frame list
+ageType *frameAge;   // frameAge[numFrames], in whole ageWords
+// the free frames are the set bits of freeMap, 64 frames a word, found a
+// word at a time; numFreeFrames is kept in step, so counting is O(1)
+typedef unsigned long long freeWord;
+#define framesPerWord 64
+freeWord *freeMap;
+int freeMapWords;
+int freeCursor = 0;   // the word the next search starts from
+int numFreeFrames;   // #frames in the free list
+// the frames and the free list change on the cpu thread (age scan, process
+// end), the swap thread (page loads) and the page-out daemon, each of these
+// holds memmutex; translation only sets age/ref/dirty flags, without it
+sem_t memmutex;
+int numZeroSkip = 0;   // demand-zero pages never written to swap at load
+int numZeroFill = 0;   // demand-zero pages filled in memory on first touch
+int clockHand = nullIndex;   // frame the replacement clock hand points to
+int numClockVictims = 0, numClockSteps = 0;
+int numRAPages = 0, numRAHits = 0, numRAWaste = 0;   // see readahead
+int numPageFaults = 0, numWriteBacks = 0;   // see page replacement policies
+int numSyncEvictions = 0, numPageOuts = 0;   // see page-out daemon
+int numPagingOut = 0, numStolenPageOuts = 0;   // see zero-copy swap IO
+int numForks = 0, numCOWFaults = 0, numCOWCopies = 0, numCOWWrites = 0;
+int numMergeScans = 0, numMerges = 0, numMergePasses = 0;   // see merging
+long mergeWordsHashed = 0, mergeWordsCompared = 0, mergeNanos = 0;
+sem_t pageoutWake;
+int pageoutAwake = 0;   // pageoutWake was posted, the daemon is not done
+int numOverAllowance = 0;   // #processes owning more frames than allowed
+sem_t pffmutex;   // frames change owners on the cpu and the swap thread
+int ageScanTicks = 1, ageScanInterval, ageScanCursor = 0;   // see age scan
 
 // define values for fields in FrameStruct
-#define zeroAge 0x00
-#define highestAge 0x80
-// #define zeroAge 0x00000000 // change ageType back to just unsigned if you want to use these two lines
-// #define highestAge 0x80000000
+#define zeroAge ((ageType) 0)
+#define highestAge ((ageType) 1 << (ageBits-1))
+// an ageWord with 1 (ageOnes) or highestAge (ageHighs) in each of its ages
+#define ageOnes (~(ageWord) 0 / (ageType) ~zeroAge)
+#define ageHighs (ageOnes * highestAge)
 #define dirtyFrame 1
 #define cleanFrame 0
 #define freeFrame 1
 #define usedFrame 0
 #define pinnedFrame 1
 #define nopinFrame 0
+#define notShared 0
+#define sharedText 1
+#define sharedCOW 2
 
 // define shifts and masks for instruction and memory address 
 #define opcodeShift 24
@@ -51,6 +117,7 @@ int freeFhead, freeFtail;   // the head and tail of free frame list
 // shift address by pagenumShift bits to get the page number
 unsigned pageoffsetMask;
 int pagenumShift; // 2^pagenumShift = pageSize
+int ptLeafShift, ptLeafMask, ptDirSize;   // see process page tables
 
 //============================
 // Our memory implementation is a mix of memory manager and physical memory.
@@ -92,7 +159,17 @@ int calculate_memory_address (unsigned offset, int rwflag)
   }
 
   //after we get the pageIndex, check the PT and return appropriate result
-  int frame = CPU.PTptr[pageIndex];
+  // the leaf of the previous translation is cached, a run of references
+  // within a leaf (most of them) takes no directory lookup
+  PageTable *pt = CPU.PTptr;
+  int frame;
+  if((pageIndex >> ptLeafShift) != pt->lastDir){
+    int *leaf = pt->dir[pageIndex >> ptLeafShift];
+    if(leaf == NULL) return mError;   // all nullPage
+    pt->lastDir = pageIndex >> ptLeafShift;
+    pt->lastLeaf = leaf;
+  }
+  frame = pt->lastLeaf[pageIndex & ptLeafMask];
   switch(frame){
     case nullPage:
       // return this since this is a access violation
@@ -101,23 +178,38 @@ int calculate_memory_address (unsigned offset, int rwflag)
       // return this since this is a page fault
         return mPFault;
       break;
+    case zeroPage:
+      // first touch of a demand-zero page, the fault handler zero fills it
+      return mPFault;
     case pendingPage:
-      // Not sure what to do here... Nothing?
-      // If it hits this, then we've done something wrong I think
-      printf("ERROR: @calculate_address() we are definitely doing something wrong\n");
-      return -1;
-	  break;
+      // the page is on its way to swap (a write back or the initial image)
+      // it faults, the read is queued behind the write
+      return mPFault;
     default: {
       int memOffset = frame * pageSize;
       int pageOffset = offset - pageIndex * pageSize;
       int address = memOffset + pageOffset;
-      memFrame[frame].age = memFrame[frame].age | highestAge;
+      frameAge[frame] = frameAge[frame] | highestAge;
+      memFrame[frame].ref = 1;
+      if(memFrame[frame].ra){ memFrame[frame].ra = 0; numRAHits++; }
+      if(memFrame[frame].prepaged == CPU.Pid){
+        memFrame[frame].prepaged = nullPid;
+        note_profile_page(CPU.Pid, pageIndex);
+      }
+      replace_referenced(frame);
+      trace_reference(CPU.Pid, pageIndex, rwflag == flagWrite);
       memFrame[frame].pinned == nopinFrame;
       if(rwflag == flagWrite){
+        // shared text is read only, writing it is an access violation
+        if(memFrame[frame].shared == sharedText) return mError;
+        // a copy-on-write page is copied by the fault handler first
+        if(memFrame[frame].shared == sharedCOW) return mPFault;
         memFrame[frame].dirty = dirtyFrame;
       }
       // If the frame was freed ad limbo, then we reinstate the frames info
-      update_frame_info(frame, CPU.Pid, pageIndex);
+      // (a shared frame keeps its owner, CPU.Pid may be one of its sharers)
+      if(memFrame[frame].shared == notShared)
+        update_frame_info(frame, CPU.Pid, pageIndex);
       return address;
     }
   }
@@ -225,39 +317,66 @@ void dump_memory ()
 
 // dump the list of free memory frames
 void dump_free_list ()
-{ int i = freeFhead;
+{ int i;
 
   printf ("******************** Free Frame List\n");
-  printf("Free Frame: ");
-  int count = 0;
-  while(i > nullIndex){ //currently gives an endless loop MJ
-    printf ("%d->", i);
-    i = memFrame[i].next;
-    count++;
-    if(count > 10){
-      i = -1;
-    }
-  }
+  printf("Free Frame (%d): ", numFreeFrames);
+  for (i = OSpages; i < numFrames; i++)
+    if (freeMap[i / framesPerWord] & (1ULL << (i % framesPerWord)))
+      printf ("%d ", i);
   printf("||\n");
 }
 
 void print_one_frameinfo (int indx)
 { printf ("pid/page/age=%d,%d,%x, ",
-          memFrame[indx].pid, memFrame[indx].page, memFrame[indx].age);
+          memFrame[indx].pid, memFrame[indx].page, frameAge[indx]);
   printf ("dir/free/pin=%d/%d/%d, ",
           memFrame[indx].dirty, memFrame[indx].free, memFrame[indx].pinned);
-  printf ("prev/next=%d,%d\n",
-          memFrame[indx].prev, memFrame[indx].next);
+  if (memFrame[indx].refs > 1 || memFrame[indx].shared != notShared)
+    printf ("shared/refs=%d/%d, ", memFrame[indx].shared, memFrame[indx].refs);
+  printf ("\n");
 }
 
+int shared_cow_savings ();
+
 void dump_memoryframe_info ()
 { int i;
 
   printf ("******************** Memory Frame Metadata\n");
+  printf ("Demand-zero pages: %d not written at load, %d filled on touch\n",
+          numZeroSkip, numZeroFill);
+  printf ("Clock replacement: %d victims, %d hand steps, hand at %d\n",
+          numClockVictims, numClockSteps, clockHand);
+  printf ("Readahead: %d pages read ahead, %d used, %d evicted unused\n",
+          numRAPages, numRAHits, numRAWaste);
+  printf ("Free frames: %d, page-out daemon freed %d, %d evictions on faults\n",
+          numFreeFrames, numPageOuts, numSyncEvictions);
+  printf ("Zero-copy swap: %d frames pinned for write-back, %d written early\n",
+          numPagingOut, numStolenPageOuts);
+  printf ("Copy-on-write: %d forks, %d write faults, %d pages copied, %d written for sharers\n",
+          numForks, numCOWFaults, numCOWCopies, numCOWWrites);
+  if (mergeScanFrames > 0)
+  { printf ("Same-page merging: %d merges of %d pages hashed (%.1f%%) in %d passes, sharing saves %d frames now\n",
+            numMerges, numMergeScans,
+            numMergeScans ? 100.0 * numMerges / numMergeScans : 0.0,
+            numMergePasses, shared_cow_savings ());
+    printf ("Merging cost: %ld words hashed, %ld compared, %ld us\n",
+            mergeWordsHashed, mergeWordsCompared, mergeNanos / 1000);
+  }
+  if (pffThreshold > 0)
+    printf ("Page-fault-frequency: %d processes over their allowance\n",
+            numOverAllowance);
+  printf ("Age scan: %d chunks, one every %d cycles, next chunk %d\n",
+          ageScanTicks, ageScanInterval, ageScanCursor);
   for (i=OSpages; i<numFrames; i++)
   { printf ("Frame %d: ", i); print_one_frameinfo (i); }
 }
 
+// see page-fault-frequency frame allocation
+void change_frame_use (int pid, int dresident, int dallowance);
+int pff_local_victim (int pid);
+int pff_victim (int findex, int pid, int local);
+
 void  update_frame_info (findex, pid, page)
 int findex, pid, page;
 {
@@ -265,21 +384,43 @@ int findex, pid, page;
   // need this function also because loader also needs to update memFrame fields
   // while it is better to not to expose memFrame fields externally
 
+  if(memFrame[findex].pid != pid){
+    change_frame_use(memFrame[findex].pid, -1, 0);
+    change_frame_use(pid, 1, 0);
+  }
   memFrame[findex].pid = pid;
   memFrame[findex].page = page;
 
   // we have to update necesarry things if frame is now free
   // by passing pid=nullPid and (page=nullIndex or page==nullPage), this will "reset" frame meta-data
   if(pid == nullPid && (page == nullIndex || page == nullPage)){
-    memFrame[findex].age = zeroAge;
+    frameAge[findex] = zeroAge;
     memFrame[findex].dirty = cleanFrame;
     memFrame[findex].free = freeFrame;
     memFrame[findex].pinned = nopinFrame;
+    memFrame[findex].shared = notShared;
+    memFrame[findex].refs = 0;
+    memFrame[findex].group = nullIndex;
+    memFrame[findex].zfill = 0;
+    memFrame[findex].ref = 0;
+    if(memFrame[findex].ra){ memFrame[findex].ra = 0; numRAWaste++; }
+    memFrame[findex].prepaged = nullPid;
+    replace_freed(findex);
   } else {
     memFrame[findex].free = usedFrame;
+    if(memFrame[findex].refs == 0) memFrame[findex].refs = 1;
   }
 }
 
+void drop_sharers (int findex);
+
+// page table entry of a clean page leaving its frame: back to disk, or
+// back to demand-zero if it was zero filled and never written since
+int clean_page_entry (int findex)
+{ return (memFrame[findex].zfill ? zeroPage : diskPage);
+}
+
+
 // should write dirty frames to disk and remove them from process page table
 // but we delay updates till the actual swap (page_fault_handler)
 // unless frames are from the terminated process (status = nullPage)
@@ -290,17 +431,17 @@ void addto_free_frame (int findex, int status)
     // if nullPage, immediately add to free pages
     // there is no need to care about properly swapping out
     // just overwrite the frame info, no loss of actual data in memory
+    // other page tables sharing the frame have to let go of it as well
+    drop_sharers(findex);
     update_frame_info(findex, nullPid, nullIndex);
 
-    // and don't forget to add to free list
-    if(freeFtail == nullIndex){
-      // if the tail is pointing to nullIndex, there's no head either
-      freeFhead = findex;
-    } else {
-      memFrame[freeFtail].next = findex;
-      memFrame[findex].prev = freeFtail;
+    // and don't forget to add to free list, a frame freed twice (which
+    // used to corrupt the list) is only counted once
+    freeWord bit = 1ULL << (findex % framesPerWord);
+    if(!(freeMap[findex / framesPerWord] & bit)){
+      freeMap[findex / framesPerWord] |= bit;
+      numFreeFrames++;
     }
-    freeFtail = findex;
   } else {
     // If it gets to this point, I think we have a problem
     // We should only add to free frames when the status is nullPage
@@ -308,142 +449,157 @@ void addto_free_frame (int findex, int status)
   }
 }
 
-int select_agest_frame ()
-{ 
-  // select a frame with the lowest age 
-  // if there are multiple frames with the same lowest age, then choose the one
-  // that is not dirty
+// CLOCK replacement: the hand sweeps the frames circularly; a frame that
+// was referenced since the hand last passed gets a second chance (its
+// reference bit is cleared), an unreferenced one is a victim.  Clean victims
+// are preferred: the first unreferenced dirty frame is remembered and only
+// taken once the hand has gone clockDirtySteps further without finding a
+// clean one, so a memory full of dirty pages does not cost a revolution
+// per fault.  Pinned frames and frames with no owner yet are skipped.
+// With page-fault-frequency allocation, frames of processes over their
+// allowance (and of pid itself when it is at its allowance) come first,
+// other unreferenced frames are only taken if there are none.
+// At most two revolutions (the first clears every reference bit), and
+// amortized a few steps per fault.  Exactly one frame is selected, the hand
+// stays past it and past every frame looked at.
+#define clockDirtySteps 16
+
+int select_clock_frame (int pid)
+{ int step, frameIndex, firstIndex = nullIndex, dirtyIndex = nullIndex;
+  int dirtyStep = 0;
+  int victim = nullIndex, otherClean = nullIndex, otherDirty = nullIndex;
+  int numUser = numFrames - OSpages;
+  int local = pff_local_victim(pid);
+  int prefer = pffThreshold > 0 && (local || numOverAllowance > 0);
+
+  if (clockHand < OSpages) clockHand = OSpages;
+  for (step = 0; step < 2*numUser; step++)
+  { frameIndex = clockHand;
+    clockHand++;
+    if (clockHand >= numFrames) clockHand = OSpages;
+    numClockSteps++;
+    if (frameIndex == firstIndex) break;   // around once, no clean one
+    if (dirtyIndex != nullIndex && step - dirtyStep >= clockDirtySteps) break;
+    if (memFrame[frameIndex].pinned == pinnedFrame ||
+        memFrame[frameIndex].pid == nullPid) continue;
+    if (memFrame[frameIndex].ref)
+    { memFrame[frameIndex].ref = 0; continue; }
+    if (firstIndex == nullIndex) firstIndex = frameIndex;
+    if (prefer && !pff_victim(frameIndex, pid, local))
+    { if (memFrame[frameIndex].dirty == cleanFrame)
+      { if (otherClean == nullIndex) otherClean = frameIndex; }
+      else if (otherDirty == nullIndex) otherDirty = frameIndex;
+      continue;
+    }
+    if (memFrame[frameIndex].dirty == cleanFrame)
+    { victim = frameIndex; break; }
+    if (dirtyIndex == nullIndex) { dirtyIndex = frameIndex; dirtyStep = step; }
+  }
+  frameIndex = victim;
+  if (frameIndex == nullIndex) frameIndex = dirtyIndex;
+  if (frameIndex == nullIndex) frameIndex = otherClean;
+  if (frameIndex == nullIndex) frameIndex = otherDirty;
+  if (frameIndex == nullIndex) return (nullIndex);
+  numClockVictims++;
+  return (frameIndex);
+}
 
-  // start iterating through, we'll be unfair and choose the first instance 
-  // if there are multiple frames that are of lower age and not dirty
+//==========================================
+// page replacement policies
+// replacePolicy picks the victim when there is no free frame: the clock
+// above, the lowest age (the original policy, a linear search), or LRU and
+// 2Q in replace.c, which are told about every load, reference and free.
+// Every policy returns exactly one frame, preferring clean, unpinned ones;
+// a clean victim is removed from its page table here, a dirty one by
+// evict_frame.  With replaceTrace, replace.c records the page
+// references, so the policies (and OPT) can be compared offline by replsim
+//==========================================
+
+char *policyName[] = { "clock", "aging", "lru", "2q" };
+
+// the oldest frame, the first clean one among equally old frames
+int select_aged_frame ()
+{ int frameIndex, victim = nullIndex;
 
-  // Strategy: Perform 2 linear searches, 
-  // First pass, get smallest age as well as count
-  int selectedFrameIndex = nullIndex;
-  unsigned ageOfOldestFrame = 0xFF;
-  
-  int frameIndex;
-  FrameStruct frame;
-  // Start at pid after OS frames
   for(frameIndex = OSpages; frameIndex < numFrames; frameIndex++){
-    frame = memFrame[frameIndex];
-    //skip the frame if it's pinned
-    if(frame.pinned == nopinFrame){
-      if(frame.age < ageOfOldestFrame){
-        ageOfOldestFrame = frame.age;
-      }
-      //if we have a clean old as cray cray frame, then we should stop/break out of search loop
-      if(ageOfOldestFrame == zeroAge){ break; }
-    }
+    if(memFrame[frameIndex].pinned == pinnedFrame ||
+       memFrame[frameIndex].pid == nullPid) continue;
+    if(victim == nullIndex || frameAge[frameIndex] < frameAge[victim] ||
+       (frameAge[frameIndex] == frameAge[victim] &&
+        memFrame[victim].dirty == dirtyFrame &&
+        memFrame[frameIndex].dirty == cleanFrame))
+      victim = frameIndex;
   }
+  return victim;
+}
 
-  int found = 0;
-  // if(ageOfOldestFrame == zeroAge){
-  for(frameIndex = OSpages; frameIndex < numFrames; frameIndex++){
-    frame = memFrame[frameIndex];
-    if(frame.pinned == nopinFrame && frame.age == ageOfOldestFrame){
-      if(selectedFrameIndex == nullIndex){
-        selectedFrameIndex = frameIndex;
-        if(frame.dirty == cleanFrame){
-          found = 1;
-          update_process_pagetable(frame.pid, frame.page, diskPage);
-        }
-      } else {
-        if(found){
-          if(frame.dirty == dirtyFrame){
-            int j = 0;
-            int i;
-            mType *outbuf = (mType*) malloc(pageSize * sizeof(mType));
-            for (i = frameIndex * pageSize; i < (frameIndex + 1) * pageSize; i++) {
-              outbuf[j] = Memory[i];
-              j++;
-            }
-            // update_process_pagetable(frame.pid, frame.page, diskPage);
-            update_process_pagetable(frame.pid, frame.page, pendingPage);
-            insert_swapQ(frame.pid, frame.page, (unsigned *) outbuf, actWrite, freeBuf);
-          } else {
-            update_process_pagetable(frame.pid, frame.page, diskPage);
-          }
-          addto_free_frame(frameIndex, nullPage);
-        } else {
-          if(frame.dirty == cleanFrame){
-            int j = 0;
-            int i;
-            mType *outbuf = (mType*) malloc(pageSize * sizeof(mType));
-            for (i = selectedFrameIndex * pageSize; i < (selectedFrameIndex + 1) * pageSize; i++) {
-              outbuf[j] = Memory[i];
-              j++;
-            }
-            // update_process_pagetable(frame.pid, frame.page, diskPage);
-            frame = memFrame[selectedFrameIndex];
-            update_process_pagetable(frame.pid, frame.page, pendingPage);
-            insert_swapQ(frame.pid, frame.page, (unsigned *) outbuf, actWrite, freeBuf);
-            addto_free_frame(selectedFrameIndex, nullPage);
-            found = 1;
-          } else {
-            int j = 0;
-            int i;
-            mType *outbuf = (mType*) malloc(pageSize * sizeof(mType));
-            for (i = frameIndex * pageSize; i < (frameIndex + 1) * pageSize; i++) {
-              outbuf[j] = Memory[i];
-              j++;
-            }
-            // update_process_pagetable(frame.pid, frame.page, diskPage);
-            update_process_pagetable(frame.pid, frame.page, pendingPage);
-            insert_swapQ(frame.pid, frame.page, (unsigned *) outbuf, actWrite, freeBuf);
-            addto_free_frame(frameIndex, nullPage);
-          }
-        }
-      }
-    }
+int select_victim_frame (int pid)
+{ int frame;
+
+  switch (replacePolicy)
+  { case replAging: frame = select_aged_frame (); break;
+    case replLRU: case repl2Q: frame = select_listed_frame (); break;
+    default: frame = select_clock_frame (pid); break;
   }
-  return selectedFrameIndex;
+  if (frame != nullIndex && memFrame[frame].dirty == cleanFrame)
+    update_process_pagetable(memFrame[frame].pid, memFrame[frame].page,
+                             clean_page_entry(frame));
+  return frame;
+}
+
+// frame metadata for replace.c
+int frame_evictable (int findex)
+{ return (memFrame[findex].pinned == nopinFrame &&
+          memFrame[findex].pid != nullPid);
 }
 
+int frame_dirty (int findex)
+{ return (memFrame[findex].dirty == dirtyFrame); }
+
+int frame_pid (int findex)
+{ return (memFrame[findex].pid); }
+
+int frame_page (int findex)
+{ return (memFrame[findex].page); }
+
+void dump_replacement_info ()
+{
+  printf ("******************** Page Replacement\n");
+  printf ("Policy %s: %d page faults, %d write-backs, %d cycles\n",
+          policyName[replacePolicy], numPageFaults, numWriteBacks,
+          CPU.numCycles);
+  dump_replacement_lists ();
+}
+
+// the free list is not walked, numFreeFrames is kept by the functions
+// below, which are called with memmutex held
 int count_free_frames(){
-  int count = 0;
-  int i;
-  for(i = OSpages; i < numFrames; i++){
-    if(memFrame[i].free == freeFrame){
-      count++;
-    }
-  }
-  return count;
+  return numFreeFrames;
 }
 
-// get a free frame from the head of the free list 
-// if there is no free frame, then get one frame with the lowest age
-// this func always returns a frame, either from free list or get one with lowest age
+// get the first free frame from freeCursor on, the lowest set bit of the
+// first non-zero word; nullIndex if there is none, then the caller
+// takes a victim of the replacement policy
 int get_free_frame (){ 
-  int freeFrameIndex;
-  // if the there is a head, then there are free pages
-  // If freeFhead is 0, then we've done something very wrong somewhere
-  // It should always be 2 or greater
-  // same for next and prev for any Q element
-  if(freeFhead != nullIndex){
-    freeFrameIndex = freeFhead;
-    int next = memFrame[freeFhead].next;
-    //if there is no next frame, then tail and head must be set to 0
-    if(next != nullIndex){
-      memFrame[next].prev = nullIndex;
-      freeFhead = next;
-    } else {
-      freeFhead = nullIndex;
-      freeFtail = nullIndex;
-    }
-    memFrame[freeFrameIndex].next = nullIndex;
-    // if the frame had been updated midway, we'll need to skip and call get_free_frame again
-    if(memFrame[freeFrameIndex].free = usedFrame){
-      return get_free_frame();
-    } else {
+  int k, w, freeFrameIndex;
+
+  if(numFreeFrames == 0) return nullIndex;
+  for(k = 0; k < freeMapWords; k++){
+    w = (freeCursor + k) % freeMapWords;
+    if(freeMap[w] != 0){
+      freeFrameIndex = w * framesPerWord + __builtin_ctzll(freeMap[w]);
+      freeMap[w] &= freeMap[w] - 1;   // clear the lowest set bit
+      freeCursor = w;
+      numFreeFrames--;
+      if(numFreeFrames < freeLowWater && !pageoutAwake){
+        pageoutAwake = 1;
+        sem_post(&pageoutWake);
+      }
+      memFrame[freeFrameIndex].free = usedFrame;
       return freeFrameIndex;
     }
-  } else {
-    // in the case there are no free frames, we'll need to get oldest frame, preferably not dirty
-    // that function is to be called explicitly outside of this function
-    
-    return nullIndex;
   }
+  return nullIndex;
 } 
 
 // this determines whether a page is all data, all instr, or a mix
@@ -452,67 +608,213 @@ int get_free_frame (){
 #define pInstr 2
 #define pMix 4
 
-int load_page_to_memory(int pid, int page, unsigned *buf, int finishact){
-  int frame = get_free_frame();
-  if (frame == nullIndex) { //no free frames
-		//get the lowest age frame
-		frame = select_agest_frame();
-    if(Debug){
-      printf("Retrieved frame %d via age replacement policy\n", frame);
+//==========================================
+// zero-copy swap IO
+// pages go between swap and their frames without a bounce buffer: a read
+// goes straight into a frame reserved for it (one readv for a readahead
+// run), a write-back straight out of the victim's frame.  A frame is
+// pinned while its IO is pending, so no replacement policy, age scan or
+// page-out daemon can take it: a reserved frame has no owner till
+// install_frame maps it, a frame being paged out keeps its owner (the page
+// table entry is pending) till swap.c has written it, and is freed then.
+// Only the swap thread reserves frames and does swap IO; if every frame is
+// pinned for a write-back, it does one of the writes right away and takes
+// that frame (the queued request then finds the write done)
+//==========================================
+
+unsigned *frame_memory (int findex)
+{ return ((unsigned *) &Memory[findex * pageSize]); }
+
+void cow_write_sharers (int findex);
+void write_frame_copy (int findex, int pid, int page);
+
+// queue the write-back of a dirty frame, straight from the frame
+void page_out_frame (int findex)
+{ int pid = memFrame[findex].pid, page = memFrame[findex].page;
+
+  cow_write_sharers(findex);
+  numWriteBacks++;
+  numPagingOut++;
+  memFrame[findex].pinned = pinnedFrame;
+  memFrame[findex].pageout = 1;
+  // the process faults on the page till it is back, the read is queued
+  // behind the write
+  update_process_pagetable(pid, page, pendingPage);
+  insert_swapQ_frame(pid, page, findex);
+}
+
+// the write-back of findex is on disk, the frame is free
+void finish_page_out (int findex)
+{ int pid = memFrame[findex].pid, page = memFrame[findex].page;
+
+  memFrame[findex].pageout = 0;
+  numPagingOut--;
+  // unless the process has terminated (its pid may be reused)
+  if (PCB[pid] != NULL && get_pagetable_entry(pid, page) == pendingPage)
+    update_process_pagetable(pid, page, diskPage);
+  addto_free_frame(findex, nullPage);
+}
+
+// is the queued write-back of pid/page from findex still to be done
+int page_out_pending (int findex, int pid, int page)
+{ return (memFrame[findex].pageout && memFrame[findex].pid == pid &&
+          memFrame[findex].page == page);
+}
+
+void end_page_out (int findex)
+{
+  sem_wait(&memmutex);
+  finish_page_out(findex);
+  sem_post(&memmutex);
+}
+
+// no frame is free nor evictable: write back a frame pinned for its
+// write-back now, on the swap thread, and use it; memmutex is let go
+// during the write (the frame stays pinned), the cpu does not wait for it
+int steal_page_out ()
+{ int findex;
+
+  for (findex = OSpages; findex < numFrames; findex++)
+    if (memFrame[findex].pageout)
+    { sem_post(&memmutex);
+      write_swap_page(memFrame[findex].pid, memFrame[findex].page,
+                      frame_memory(findex));
+      sem_wait(&memmutex);
+      numStolenPageOuts++;
+      finish_page_out(findex);
+      return (get_free_frame());
     }
-		//need to identify the pid of the frame being swapped out
-		int pidout = memFrame[frame].pid;
-		int pageout = memFrame[frame].page;
-
-		if (memFrame[frame].dirty == dirtyFrame) {
-			// if the frame is dirty, insert a write request to swapQ 
-			//buf will be the contents of the frame in memory
-			//mType outbuf = (mType *)malloc(pageSize * sizeof(mType));
-			//mType outbuf = Memory[frame * pageSize];
-			int j = 0;
-      int i;
-			mType *outbuf = (mType*) malloc(pageSize * sizeof(mType));
-			for (i = frame * pageSize; i < (frame + 1) * pageSize; i++) {
-				outbuf[j] = Memory[i];
-				j++;
-			}
-      update_process_pagetable(pidout, pageout, pendingPage);  //changed because I want to make sure that this will pfault if
-            // the page needs to be accessed
-			insert_swapQ(pidout, pageout, (unsigned *) outbuf, actWrite, freeBuf);
-		}
-		//else since the frame isn't dirty, we don't need to write back to swapQ
-	} else {
+  return (nullIndex);
+}
+
+// take a victim frame from its page tables (a clean one was unmapped by
+// select_victim_frame), the frame keeps its metadata till it is reused or
+// freed.  A dirty page is written straight from the frame, right away when
+// now (only on the swap thread, memmutex is let go during the write, the
+// frame is pinned and its page table entry pending), else queued with the
+// frame pinned; returns whether the frame can be reused now
+int evict_frame (int frame, int now)
+{ int pidout = memFrame[frame].pid, pageout = memFrame[frame].page;
+
+  cow_write_sharers(frame);   // a copy-on-write frame has no sharers then
+  drop_sharers(frame);   // the owner is handled below, the sharers here
+  if(memFrame[frame].ra){ memFrame[frame].ra = 0; numRAWaste++; }
+  if(memFrame[frame].dirty == cleanFrame) return 1;
+  if(!now){
+    page_out_frame(frame);
+    return 0;
+  }
+  numWriteBacks++;
+  update_process_pagetable(pidout, pageout, pendingPage);
+  memFrame[frame].pinned = pinnedFrame;
+  sem_post(&memmutex);
+  write_swap_page(pidout, pageout, frame_memory(frame));
+  sem_wait(&memmutex);
+  // unless the process has terminated meanwhile (its pid may be reused),
+  // then its frames were uncounted already
+  if (PCB[pidout] != NULL && get_pagetable_entry(pidout, pageout) == pendingPage)
+    update_process_pagetable(pidout, pageout, diskPage);
+  else memFrame[frame].pid = nullPid;
+  memFrame[frame].dirty = cleanFrame;
+  return 1;
+}
+
+// a frame for a page of pid to be read or copied into, taken off the free
+// list or from a victim of the replacement policy, pinned and with no
+// owner till install_frame; only called on the swap thread
+int reserve_frame (int pid)
+{ int frame;
+
+  sem_wait(&memmutex);
+  frame = get_free_frame();
+  if (frame == nullIndex) { //no free frames
+    //get a victim from the replacement policy
+    frame = select_victim_frame(pid);
+    if (frame != nullIndex) {
+      numSyncEvictions++;
+      evict_frame(frame, 1);
+    } else frame = steal_page_out();
     if(Debug){
-      printf("Retrieved frame %d from free frame queue\n", frame);
+      printf("Retrieved frame %d via %s replacement policy\n", frame,
+             policyName[replacePolicy]);
     }
-    // FrameStruct f = memFrame[frame];
-    // if(f.page != nullIndex){
-    //   update_process_pagetable(f.page, f.page, diskPage);
-    // }
+  } else if(Debug){
+    printf("Retrieved frame %d from free frame queue\n", frame);
+  }
+  if (frame != nullIndex) {
+    update_frame_info(frame, nullPid, nullIndex);
+    memFrame[frame].free = usedFrame;
+    memFrame[frame].pinned = pinnedFrame;
   }
+  sem_post(&memmutex);
+  return frame;
+}
 
+// the reserved frame holds page of pid now, map it; zfill: it was zero
+// filled, not read
+void map_frame (int frame, int pid, int page, int zfill)
+{
+  update_frame_info(frame, pid, page);
+  frameAge[frame] = highestAge;
+  memFrame[frame].ref = 1;
+  memFrame[frame].zfill = zfill;
+  memFrame[frame].pinned = nopinFrame;
+  memFrame[frame].prepaged = nullPid;
+  update_process_pagetable(pid, page, frame);
+  register_text_page(pid, page, frame);
+  replace_loaded(frame, pid, page);
+}
+
+void install_frame (int frame, int pid, int page, int zfill)
+{
   if(Debug){
     printf("Loading page %d of pid %d to memory\n", page, pid);
   }
-  // Needed to properly interpret the incoming buffer, apparently
-  mType *inbuf = (mType *) buf;
-  int j = 0;
-  int i;
-  for (i = frame * pageSize; i < (frame + 1) * pageSize; i++) {
-    Memory[i] = inbuf[j];  
-    j++;
-  }
+  sem_wait(&memmutex);
+  map_frame(frame, pid, page, zfill);
+  sem_post(&memmutex);
+}
 
-  update_frame_info(frame, pid, page);
-  memFrame[frame].age = highestAge;
-  update_process_pagetable(pid, page, frame);
-  free(inbuf);
-  if(finishact == toReady){
-    // insert_ready_process(pid);
+// the reserved frame is not needed after all
+void release_frame (int frame)
+{
+  sem_wait(&memmutex);
+  addto_free_frame(frame, nullPage);
+  sem_post(&memmutex);
+}
+
+// a page that is not read from swap (from the loader), copied from buf
+int load_page_to_memory(int pid, int page, unsigned *buf, int finishact){
+  int frame = reserve_frame(pid);
+
+  if (frame == nullIndex) {
+    printf("ERROR: no frame for page %d of pid %d\n", page, pid);
+    free(buf);
+    return -1;
   }
+  memcpy(frame_memory(frame), buf, pageSize * sizeof(mType));
+  install_frame(frame, pid, page, 0);
+  mark_prepaged(pid, page);
+  free(buf);
   return 0;
 }
 
+// a page the loader put in for pid (read or shared) only goes into its
+// profile when pid first references it, before that the page may be
+// dropped or shared by another process, see prepaging profiles (loader.c)
+void mark_prepaged (int pid, int page)
+{ int frame;
+
+  if(PCB[pid]->profile == NULL) return;
+  sem_wait(&memmutex);
+  frame = get_pagetable_entry(pid, page);
+  if(frame >= 0 && memFrame[frame].prepaged == nullPid)
+    memFrame[frame].prepaged = pid;
+  sem_post(&memmutex);
+}
+
+void initialize_merging ();
+
 void initialize_memory ()
 { int i;
 
@@ -523,58 +825,110 @@ void initialize_memory ()
   }
 
   memFrame = (FrameStruct *) malloc (numFrames*sizeof(FrameStruct));
+  frameAge = (ageType *) calloc ((numFrames+agesPerWord-1) / agesPerWord,
+                                 sizeof(ageWord));
 
   // compute #bits for page offset, set pagenumShift and pageoffsetMask
   // *** ADD CODE
   pagenumShift = (int)round(log2(pageSize)); // I'm rounding just in case I have some imprecision
   pageoffsetMask = ~(-1 << pagenumShift);
+  // page table leaves of about sqrt(maxPpages) entries, at least 64, so
+  // neither the directory nor a leaf grows much with the address space
+  ptLeafShift = 6;
+  while ((1L << (2*ptLeafShift)) < maxPpages) ptLeafShift++;
+  ptLeafMask = (1 << ptLeafShift) - 1;
+  ptDirSize = (maxPpages + ptLeafMask) >> ptLeafShift;
 
   // initialize OS pages
   for (i=0; i<OSpages; i++)
-  { memFrame[i].age = zeroAge;
+  { frameAge[i] = zeroAge;
     memFrame[i].dirty = cleanFrame;
     memFrame[i].free = usedFrame;
     memFrame[i].pinned = pinnedFrame;
+    memFrame[i].shared = notShared;
+    memFrame[i].refs = 1;
+    memFrame[i].group = nullIndex;
+    memFrame[i].sharers = NULL;
+    memFrame[i].zfill = 0;
+    memFrame[i].ref = 0;
+    memFrame[i].ra = 0;
+    memFrame[i].pageout = 0;
+    memFrame[i].prepaged = nullPid;
     memFrame[i].pid = osPid;
-    memFrame[i].next = nullIndex;
-    memFrame[i].prev = nullIndex;
   }
   // initilize the remaining pages, also put them in free list
   // *** ADD CODE
   // Create pages and set them as free pages
   for(i = OSpages; i<numFrames; i++){
-    memFrame[i].age = zeroAge;
+    frameAge[i] = zeroAge;
     memFrame[i].dirty = cleanFrame;
     memFrame[i].free = freeFrame;
     memFrame[i].pinned = nopinFrame;
-    memFrame[i].next = nullIndex;
-    memFrame[i].prev = nullIndex;
+    memFrame[i].shared = notShared;
+    memFrame[i].refs = 0;
+    memFrame[i].group = nullIndex;
+    memFrame[i].sharers = NULL;
+    memFrame[i].zfill = 0;
+    memFrame[i].ref = 0;
+    memFrame[i].ra = 0;
+    memFrame[i].pageout = 0;
+    memFrame[i].prepaged = nullPid;
+    memFrame[i].pid = nullPid;
+    memFrame[i].page = nullIndex;
   }
 
-  // Create the next free frame for all but the last frame
-  for(i = OSpages; i<numFrames-1; i++){
-    memFrame[i].next = i+1;
-  }
-
-  // Create the prev free frame for all but the first free frame
-  for(i = numFrames - 1; i > OSpages; i--){
-    memFrame[i].prev = i-1;
+  // all user frames are free, the OS frames never are
+  freeMapWords = (numFrames + framesPerWord - 1) / framesPerWord;
+  freeMap = (freeWord *) calloc (freeMapWords, sizeof(freeWord));
+  for(i = OSpages; i<numFrames; i++){
+    freeMap[i / framesPerWord] |= 1ULL << (i % framesPerWord);
   }
-
-  // First free frame is at OSpages, last is at numFrames-1
-  freeFhead = OSpages;
-  freeFtail = numFrames - 1;
+  numFreeFrames = numFrames - OSpages;
+  if (mergeScanFrames > 0) initialize_merging();
 }
 
 //==========================================
 // process page table manamgement
+// two levels: the directory has ptDirSize leaf pointers, a leaf is
+// allocated on the first entry that is not nullPage, and only freed with
+// the process.  So the untouched parts of a large address space cost
+// nothing but their directory slot, and walks skip them
 //==========================================
 
 void init_process_pagetable (int pid)
-{ int i;
+{ PageTable *pt = (PageTable *) malloc (sizeof(PageTable));
+
+  pt->dir = (int **) calloc (ptDirSize, sizeof(int *));
+  pt->numLeaves = 0;
+  pt->lastDir = nullIndex;
+  pt->lastLeaf = NULL;
+  PCB[pid]->PTptr = pt;
+}
+
+void free_process_pagetable (int pid)
+{ PageTable *pt = PCB[pid]->PTptr;
+  int d;
+
+  for (d = 0; d < ptDirSize; d++) free (pt->dir[d]);
+  free (pt->dir);
+  free (pt);
+  PCB[pid]->PTptr = NULL;
+}
 
-  PCB[pid]->PTptr = (int *) malloc (sizeof(int)*maxPpages);
-  for (i=0; i<maxPpages; i++) PCB[pid]->PTptr[i] = nullPage;
+// the leaf holding the entry of page, allocated if alloc (else NULL if
+// it is absent)
+int *pagetable_leaf (PageTable *pt, int page, int alloc)
+{ int d = page >> ptLeafShift, k;
+  int *leaf = pt->dir[d];
+
+  if (leaf != NULL || !alloc) return (leaf);
+  leaf = (int *) malloc ((ptLeafMask+1) * sizeof(int));
+  for (k = 0; k <= ptLeafMask; k++) leaf[k] = nullPage;
+  // the cpu thread and the swap thread may both add the leaf
+  if (__sync_bool_compare_and_swap (&pt->dir[d], NULL, leaf))
+    __sync_fetch_and_add (&pt->numLeaves, 1);
+  else { free (leaf); leaf = pt->dir[d]; }
+  return (leaf);
 }
 
 // frame can be normal frame number or nullPage, diskPage
@@ -584,7 +938,44 @@ int pid, page, frame;
 { 
   // update the page table entry for process pid to point to the frame
   // or point to disk or null
-  PCB[pid]->PTptr[page] = frame;
+  int *leaf = pagetable_leaf (PCB[pid]->PTptr, page, frame != nullPage);
+  if (leaf != NULL) leaf[page & ptLeafMask] = frame;
+}
+
+int get_pagetable_entry (int pid, int page)
+{ int *leaf = pagetable_leaf (PCB[pid]->PTptr, page, 0);
+
+  return (leaf == NULL ? nullPage : leaf[page & ptLeafMask]);
+}
+
+// the first page from page on that has a leaf, maxPpages if none
+int next_pagetable_page (int pid, int page)
+{ PageTable *pt = PCB[pid]->PTptr;
+
+  while (page < maxPpages && pt->dir[page >> ptLeafShift] == NULL)
+    page = ((page >> ptLeafShift) + 1) << ptLeafShift;
+  return (page < maxPpages ? page : maxPpages);
+}
+
+// the loader found an all zero page, it is not written to swap
+void set_zero_page (int pid, int page)
+{ update_process_pagetable (pid, page, zeroPage);
+  numZeroSkip++;
+}
+
+// first touch of a demand-zero page: zero a frame, no disk read
+// called by swap.c for actZeroFill
+void zero_fill_page (int pid, int page)
+{ int frame = reserve_frame (pid);
+
+  if (frame == nullIndex)
+  { update_process_pagetable (pid, page, zeroPage);   // faults again
+    return;
+  }
+  memset (frame_memory (frame), 0, pageSize * sizeof(mType));
+  install_frame (frame, pid, page, 1);
+  numZeroFill++;
+  if (memDebug) printf ("Zero filled page %d of process %d\n", page, pid);
 }
 
 int free_process_memory (int pid)
@@ -592,8 +983,10 @@ int free_process_memory (int pid)
   // free the memory frames for a terminated process
   // some frames may have already been freed, but still in process pagetable
   int pageIndex, frameIndex;
-  for(pageIndex = 0; pageIndex < maxPpages; pageIndex++){
-    frameIndex = PCB[pid]->PTptr[pageIndex];
+  sem_wait(&memmutex);
+  for(pageIndex = next_pagetable_page(pid, 0); pageIndex < maxPpages;
+      pageIndex = next_pagetable_page(pid, pageIndex+1)){
+    frameIndex = get_pagetable_entry(pid, pageIndex);
     switch(frameIndex){
       case nullPage:
         // don't need to do anything I think
@@ -601,22 +994,96 @@ int free_process_memory (int pid)
         // Technically don't need to do anything
       case pendingPage:
         // I'm hoping we don't have to deal with this, cuz I don't know how'd we handle this
+      case zeroPage:
+        // never got a frame nor a swap copy
         break;
       default:
         // update_frame_info(frameIndex, nullPid, nullIndex);
-        addto_free_frame(frameIndex, nullPage);
+        // a shared frame stays in memory for the other sharers
+        if(memFrame[frameIndex].refs > 1)
+          leave_shared_frame(frameIndex, pid, pageIndex);
+        else addto_free_frame(frameIndex, nullPage);
         break;
     }
   }
+  sem_post(&memmutex);
+  detach_text_share(pid);
+  // its pooled pages may still be copied for a forked child, see swap.c
+  if(zswapKB > 0) insert_swapQ(pid, 0, NULL, actDropPool, Nothing);
+  // frames still counted (e.g. limbo frames) are not its anymore
+  change_frame_use(pid, -PCB[pid]->resident, 0);
+  trace_end(pid);
+}
+
+// used by the medium-term scheduler to suspend a whole process
+// write back the dirty frames of process pid and release all its frames
+// the resident pages are returned in pages, so that they can be brought
+// back in as a batch when the process is resumed, returns #pages
+// the swap set grows as needed: merged pages of pid map one frame, so it
+// can have more pages than there are user frames
+void add_swap_set_page (int **pages, int *count, int *size, int page)
+{
+  if(*count == *size){
+    *size = 2 * *size;
+    *pages = (int *) realloc(*pages, *size * sizeof(int));
+  }
+  (*pages)[(*count)++] = page;
+}
+
+int swapout_process_memory (int pid, int **pages)
+{ int pageIndex, frameIndex, entry;
+  int count = 0, size = 64;
+
+  *pages = (int *) malloc(size * sizeof(int));
+  sem_wait(&memmutex);
+  for(pageIndex = next_pagetable_page(pid, 0); pageIndex < maxPpages;
+      pageIndex = next_pagetable_page(pid, pageIndex+1)){
+    frameIndex = get_pagetable_entry(pid, pageIndex);
+    if(frameIndex < 0) continue;   // nullPage, diskPage or pendingPage
+    if(memFrame[frameIndex].refs > 1){
+      // the other sharers keep the frame; shared text and merged pages
+      // are clean, a forked page is written to the swap space of pid
+      // (a merged zero filled page is filled again on touch)
+      entry = clean_page_entry(frameIndex);
+      if(memFrame[frameIndex].shared == sharedCOW &&
+         memFrame[frameIndex].dirty == dirtyFrame)
+        write_frame_copy(frameIndex, pid, pageIndex);
+      else update_process_pagetable(pid, pageIndex, entry);
+      leave_shared_frame(frameIndex, pid, pageIndex);
+      if(entry != zeroPage || memFrame[frameIndex].dirty == dirtyFrame)
+        add_swap_set_page(pages, &count, &size, pageIndex);
+      continue;
+    }
+    if(memFrame[frameIndex].dirty == cleanFrame && memFrame[frameIndex].zfill){
+      // still all zeros, it is filled again on touch, no need to swap it in
+      update_process_pagetable(pid, pageIndex, zeroPage);
+      addto_free_frame(frameIndex, nullPage);
+      continue;
+    }
+    if(memFrame[frameIndex].dirty == dirtyFrame){
+      // the frame is freed once swap.c has written it
+      page_out_frame(frameIndex);
+    } else {
+      update_process_pagetable(pid, pageIndex, diskPage);
+      addto_free_frame(frameIndex, nullPage);
+    }
+    add_swap_set_page(pages, &count, &size, pageIndex);
+  }
+  sem_post(&memmutex);
+  if(memDebug) printf("Swapped out %d pages of process %d\n", count, pid);
+  return count;
 }
 
 void dump_process_pagetable (int pid)
 { 
   // print page table entries of process pid
   printf ("************** Page Table for Process pid: %d\n", pid);
+  printf ("%d of %d leaves of %d entries\n", PCB[pid]->PTptr->numLeaves,
+          ptDirSize, ptLeafMask+1);
   int i;
-  for (i=0; i<maxPpages; i++) { 
-    printf ("Page %d @ %d: ", i, PCB[pid]->PTptr[i]); 
+  for (i=next_pagetable_page(pid, 0); i<maxPpages;
+       i=next_pagetable_page(pid, i+1)) { 
+    printf ("Page %d @ %d: ", i, get_pagetable_entry(pid, i)); 
   }
 
 }
@@ -627,7 +1094,7 @@ void dump_process_memory (int pid)
   printf ("************** Memory Content for Process pid: %d\n", pid);
   int i, frame;
   for (i=0; i<maxPpages; i++) { 
-    frame = PCB[pid]->PTptr[i];
+    frame = get_pagetable_entry(pid, i);
     switch(frame){
       case nullPage:
         // break out of for loop by setting i to maxPpages
@@ -641,6 +1108,9 @@ void dump_process_memory (int pid)
         printf("Page %d is in SWAPQ. Most recent page in DISK is: \n", i);
         dump_process_swap_page(pid,i);
         break;
+      case zeroPage:
+        printf("Page %d is a demand-zero page\n", i);
+        break;
       default:
         dump_one_frame(frame);
         break;
@@ -648,6 +1118,584 @@ void dump_process_memory (int pid)
   }
 }
 
+//==========================================
+// shared text pages
+// processes running the same program image (same path, mtime and size)
+// join a text group; the pages holding only instructions are shared
+// the group remembers the frame holding each resident text page, a fault
+// on such a page just maps that frame, no disk read is needed
+// the frame owner is in memFrame pid/page, the other mappers in sharers
+// text is never written, so dropping a sharer only points it back to disk
+//==========================================
+
+typedef struct
+{ char *key;          // program path:mtime:size
+  int numTextPages;   // pages 0..numTextPages-1 hold only instructions
+  int *frame;         // frame[page], or nullIndex if not resident
+  int users;          // #processes in the group
+} TextGroup;
+
+TextGroup **textGroups = NULL;
+int numTextGroups = 0;
+sem_t textmutex;   // loader threads attach processes concurrently
+
+void attach_text_share (int pid, char *key, int numTextPages)
+{ int g, slot = nullIndex, i;
+
+  PCB[pid]->textGroup = nullIndex;
+  if (numTextPages <= 0) return;
+  sem_wait (&textmutex);
+  for (g = 0; g < numTextGroups; g++)
+  { if (textGroups[g] == NULL) { if (slot == nullIndex) slot = g; }
+    else if (strcmp (textGroups[g]->key, key) == 0) break;
+  }
+  if (g == numTextGroups)
+  { if (slot == nullIndex)
+    { textGroups = (TextGroup **) realloc
+                     (textGroups, (numTextGroups+1) * sizeof(TextGroup *));
+      slot = numTextGroups++;
+    }
+    g = slot;
+    textGroups[g] = (TextGroup *) malloc (sizeof(TextGroup));
+    textGroups[g]->key = strdup (key);
+    textGroups[g]->numTextPages = numTextPages;
+    textGroups[g]->frame = (int *) malloc (numTextPages * sizeof(int));
+    for (i = 0; i < numTextPages; i++) textGroups[g]->frame[i] = nullIndex;
+    textGroups[g]->users = 0;
+  }
+  textGroups[g]->users++;
+  PCB[pid]->textGroup = g;
+  sem_post (&textmutex);
+  if (memDebug) printf ("Process %d joins text group %d (%s)\n", pid, g, key);
+}
+
+// called when the process frees its memory, all its frames are gone
+void detach_text_share (int pid)
+{ int g = PCB[pid]->textGroup;
+
+  if (g == nullIndex) return;
+  PCB[pid]->textGroup = nullIndex;
+  sem_wait (&textmutex);
+  textGroups[g]->users--;
+  if (textGroups[g]->users == 0)
+  { free (textGroups[g]->key);
+    free (textGroups[g]->frame);
+    free (textGroups[g]);
+    textGroups[g] = NULL;
+  }
+  sem_post (&textmutex);
+}
+
+// a text page of pid has been loaded to frame, offer it to the group
+void register_text_page (int pid, int page, int frame)
+{ int g = PCB[pid]->textGroup;
+
+  if (g == nullIndex) return;
+  sem_wait (&textmutex);
+  if (page < textGroups[g]->numTextPages &&
+      textGroups[g]->frame[page] == nullIndex)
+  { textGroups[g]->frame[page] = frame;
+    memFrame[frame].shared = sharedText;
+    memFrame[frame].group = g;
+  }
+  sem_post (&textmutex);
+}
+
+// map page of pid to the resident frame of its text group, if there is one
+// returns 1 if mapped, 0 if the page has to come from disk
+int map_shared_text_page (int pid, int page)
+{ int g = PCB[pid]->textGroup;
+  int frame;
+  FrameMap *map;
+
+  if (g == nullIndex) return (0);
+  sem_wait (&textmutex);
+  if (page < textGroups[g]->numTextPages) frame = textGroups[g]->frame[page];
+  else frame = nullIndex;
+  sem_post (&textmutex);
+  if (frame == nullIndex) return (0);
+  map = (FrameMap *) malloc (sizeof(FrameMap));
+  map->pid = pid; map->page = page;
+  map->next = memFrame[frame].sharers;
+  memFrame[frame].sharers = map;
+  memFrame[frame].refs++;
+  frameAge[frame] = frameAge[frame] | highestAge;
+  update_process_pagetable (pid, page, frame);
+  if (memDebug)
+    printf ("Process %d page %d shares frame %d (refs=%d)\n",
+            pid, page, frame, memFrame[frame].refs);
+  return (1);
+}
+
+// map_shared_text_page for the fault path and the loader, the group's
+// frame cannot be evicted or reused while it is mapped
+int share_text_page (int pid, int page)
+{ int mapped;
+
+  sem_wait (&memmutex);
+  mapped = map_shared_text_page (pid, page);
+  sem_post (&memmutex);
+  return (mapped);
+}
+
+// pid drops its mapping of a frame that others still map
+void leave_shared_frame (int findex, int pid, int page)
+{ FrameMap *map, **prev;
+
+  if (memFrame[findex].pid == pid && memFrame[findex].page == page)
+  { // the owner leaves, the first sharer becomes the owner
+    map = memFrame[findex].sharers;
+    change_frame_use (pid, -1, 0);
+    change_frame_use (map->pid, 1, 0);
+    memFrame[findex].pid = map->pid;
+    memFrame[findex].page = map->page;
+    memFrame[findex].sharers = map->next;
+    free (map);
+  }
+  else
+  { for (prev = &memFrame[findex].sharers; *prev != NULL;
+         prev = &(*prev)->next)
+      if ((*prev)->pid == pid && (*prev)->page == page)
+      { map = *prev; *prev = map->next; free (map); break; }
+  }
+  memFrame[findex].refs--;
+  // the last mapper of a copy-on-write page may write it in place
+  if (memFrame[findex].refs == 1 && memFrame[findex].shared == sharedCOW)
+    memFrame[findex].shared = notShared;
+}
+
+// the frame is evicted or reused, the sharers go back to their swap copy
+// (or to demand-zero, a merged zero filled page was only merged with such)
+// the owner's page table is taken care of by the caller
+void drop_sharers (int findex)
+{ FrameMap *map, *next;
+  int g;
+
+  for (map = memFrame[findex].sharers; map != NULL; map = next)
+  { next = map->next;
+    if (PCB[map->pid] != NULL)
+      update_process_pagetable (map->pid, map->page, clean_page_entry (findex));
+    free (map);
+  }
+  memFrame[findex].sharers = NULL;
+  g = memFrame[findex].group;
+  if (memFrame[findex].shared == sharedText && g != nullIndex)
+  { sem_wait (&textmutex);
+    if (textGroups[g] != NULL &&
+        textGroups[g]->frame[memFrame[findex].page] == findex)
+      textGroups[g]->frame[memFrame[findex].page] = nullIndex;
+    sem_post (&textmutex);
+  }
+  memFrame[findex].shared = notShared;
+  memFrame[findex].group = nullIndex;
+  if (memFrame[findex].refs > 1) memFrame[findex].refs = 1;
+}
+
+// a forked child runs its parent's program, it joins its text group
+void fork_text_share (int ppid, int pid)
+{ int g = PCB[ppid]->textGroup;
+
+  PCB[pid]->textGroup = g;
+  if (g == nullIndex) return;
+  sem_wait (&textmutex);
+  textGroups[g]->users++;
+  sem_post (&textmutex);
+}
+
+//==========================================
+// copy-on-write fork
+// a forked child maps every resident frame of its parent as a sharer (as
+// in text sharing), the frames become sharedCOW: all mappers read them, a
+// write faults and the writer gets a private copy, made on the swap thread
+// (cow_copy_page); the last mapper writes the frame in place.
+// Swap space is per process, so the child's swap space gets copies of the
+// parent's pages that are not resident (and of its text pages) by one swap
+// request, queued before any page fault of the child.  The shared frames
+// are marked dirty instead: a sharedCOW frame leaving memory is written to
+// the swap space of each of its mappers, never read back from the parent's
+//==========================================
+
+// pid maps page to frame as well
+void add_frame_sharer (int frame, int pid, int page)
+{ FrameMap *map = (FrameMap *) malloc (sizeof(FrameMap));
+
+  map->pid = pid; map->page = page;
+  map->next = memFrame[frame].sharers;
+  memFrame[frame].sharers = map;
+  memFrame[frame].refs++;
+  update_process_pagetable(pid, page, frame);
+}
+
+void fork_process_memory (int ppid, int pid)
+{ int page, frame, n = 0, size = 64;
+  unsigned *pages = (unsigned *) malloc (size * sizeof(unsigned));
+
+  fork_text_share(ppid, pid);
+  sem_wait(&memmutex);
+  for(page = next_pagetable_page(ppid, 0); page < maxPpages;
+      page = next_pagetable_page(ppid, page+1)){
+    frame = get_pagetable_entry(ppid, page);
+    if(frame == nullPage) continue;
+    if(frame == zeroPage){
+      update_process_pagetable(pid, page, zeroPage);
+      continue;
+    }
+    if(frame >= 0){
+      add_frame_sharer(frame, pid, page);
+      if(memFrame[frame].shared != sharedText){
+        memFrame[frame].shared = sharedCOW;
+        memFrame[frame].dirty = dirtyFrame;
+        continue;
+      }
+    }
+    else update_process_pagetable(pid, page, diskPage);   // or pending
+    if(n == size){
+      size = 2 * size;
+      pages = (unsigned *) realloc (pages, size * sizeof(unsigned));
+    }
+    pages[n++] = page;
+  }
+  sem_post(&memmutex);
+  numForks++;
+  if(n > 0) insert_swapQ_copy(pid, ppid, pages, n);
+  else free(pages);
+  if(memDebug) printf("Process %d forked %d, %d swap pages to copy\n",
+                      ppid, pid, n);
+}
+
+// pid's copy of a shared frame goes to its swap space from a buffer, the
+// frame stays in memory for the others
+void write_frame_copy (int findex, int pid, int page)
+{ unsigned *buf = (unsigned *) malloc (pageSize * sizeof(mType));
+
+  memcpy(buf, frame_memory(findex), pageSize * sizeof(mType));
+  update_process_pagetable(pid, page, pendingPage);
+  insert_swapQ(pid, page, buf, actWrite, freeBuf);
+  numCOWWrites++;
+}
+
+// a dirty sharedCOW frame leaves memory: the sharers' copies are written
+// here, the owner's by the caller, the frame is the owner's alone then
+// (a clean one, a merged page, is dropped by drop_sharers)
+void cow_write_sharers (int findex)
+{ FrameMap *map, *next;
+
+  if (memFrame[findex].shared != sharedCOW ||
+      memFrame[findex].dirty == cleanFrame) return;
+  for (map = memFrame[findex].sharers; map != NULL; map = next)
+  { next = map->next;
+    if (PCB[map->pid] != NULL) write_frame_copy (findex, map->pid, map->page);
+    free (map);
+  }
+  memFrame[findex].sharers = NULL;
+  memFrame[findex].shared = notShared;
+  memFrame[findex].refs = 1;
+}
+
+// a write fault on a sharedCOW page, on the swap thread: pid gets a private
+// copy, unless the frame has stopped being shared (or has left memory) since
+void cow_copy_page (int pid, int page)
+{ int old, frame = reserve_frame(pid);
+
+  if (frame == nullIndex) return;   // it faults again when it runs
+  sem_wait(&memmutex);
+  old = get_pagetable_entry(pid, page);
+  if (old >= 0 && memFrame[old].shared == sharedCOW && memFrame[old].refs > 1)
+  { memcpy(frame_memory(frame), frame_memory(old), pageSize * sizeof(mType));
+    leave_shared_frame(old, pid, page);
+    map_frame(frame, pid, page, 0);
+    memFrame[frame].dirty = dirtyFrame;
+    numCOWCopies++;
+  }
+  else
+  { if (old >= 0 && memFrame[old].shared == sharedCOW)
+      memFrame[old].shared = notShared;
+    addto_free_frame(frame, nullPage);
+  }
+  sem_post(&memmutex);
+}
+
+//==========================================
+// same-page merging
+// resident clean pages with the same contents, of any processes, are
+// merged into one frame, a sharedCOW frame as after a fork: a write
+// un-merges the writer's page with a private copy (cow_copy_page).
+// The merger runs on the age interrupts, mergeScanFrames frames each, in
+// passes over the frames: a frame's page is hashed and looked up in the
+// table of the pass, it is merged into a frame holding an equal page, or
+// else goes into the table.  The table is emptied when a pass starts; a
+// frame in it may have been reused since, so pages are compared in full.
+// A clean page has its copy in swap, so a merged frame leaves memory with
+// no writes; a zero filled page (no swap copy) only merges with another
+//==========================================
+
+int *mergeTable;    // mergeTable[hash % mergeTableSize]: the first frame
+int mergeTableSize;
+int *mergeNext;     // mergeNext[frame]: the next frame in its hash chain
+unsigned *mergeKey; // mergeKey[frame]: the hash of its page
+int mergeCursor;    // the frame to scan next
+
+int merge_candidate (int findex)
+{ int pid = memFrame[findex].pid;
+
+  return (memFrame[findex].free == usedFrame && pid != nullPid &&
+          memFrame[findex].pinned == nopinFrame &&
+          memFrame[findex].dirty == cleanFrame && !memFrame[findex].ra &&
+          memFrame[findex].shared != sharedText && PCB[pid] != NULL &&
+          get_pagetable_entry(pid, memFrame[findex].page) == findex);
+}
+
+unsigned merge_hash (int findex)
+{ unsigned *word = frame_memory(findex), hash = 2166136261u;
+  int k, n = pageSize * sizeof(mType) / sizeof(unsigned);
+
+  for (k = 0; k < n; k++) hash = (hash ^ word[k]) * 16777619u;   // FNV-1a
+  mergeWordsHashed += n;
+  return (hash);
+}
+
+int same_page (int f, int g)
+{
+  mergeWordsCompared += pageSize * sizeof(mType) / sizeof(unsigned);
+  return (memFrame[f].zfill == memFrame[g].zfill &&
+          memcmp(frame_memory(f), frame_memory(g),
+                 pageSize * sizeof(mType)) == 0);
+}
+
+// all mappers of findex map into instead, findex is freed
+void merge_frame (int findex, int into)
+{ FrameMap *map, *next;
+
+  add_frame_sharer(into, memFrame[findex].pid, memFrame[findex].page);
+  for (map = memFrame[findex].sharers; map != NULL; map = next)
+  { next = map->next;
+    add_frame_sharer(into, map->pid, map->page);
+    free(map);
+  }
+  memFrame[findex].sharers = NULL;
+  memFrame[into].shared = sharedCOW;
+  frameAge[into] = frameAge[into] | frameAge[findex];
+  memFrame[into].ref = memFrame[into].ref | memFrame[findex].ref;
+  addto_free_frame(findex, nullPage);
+  if (memDebug) printf ("Merged frame %d into frame %d (refs=%d)\n",
+                        findex, into, memFrame[into].refs);
+}
+
+// scan the next mergeScanFrames frames, on the age interrupts
+void merge_scan ()
+{ struct timespec t0, t1;
+  unsigned hash;
+  int n, f, g;
+
+  if (mergeScanFrames == 0) return;
+  sem_wait(&memmutex);
+  clock_gettime(CLOCK_MONOTONIC, &t0);   // the scan, not waiting for the lock
+  for (n = 0; n < mergeScanFrames; n++)
+  { if (mergeCursor == OSpages)   // a new pass
+    { for (g = 0; g < mergeTableSize; g++) mergeTable[g] = nullIndex;
+      numMergePasses++;
+    }
+    f = mergeCursor;
+    mergeCursor = (f + 1 < numFrames) ? f + 1 : OSpages;
+    if (!merge_candidate(f)) continue;
+    numMergeScans++;
+    hash = merge_hash(f);
+    for (g = mergeTable[hash % mergeTableSize]; g != nullIndex;
+         g = mergeNext[g])
+      if (g != f && mergeKey[g] == hash && merge_candidate(g) &&
+          same_page(f, g)) break;
+    if (g != nullIndex)
+    { merge_frame(f, g);
+      numMerges++;
+    }
+    else
+    { mergeKey[f] = hash;
+      mergeNext[f] = mergeTable[hash % mergeTableSize];
+      mergeTable[hash % mergeTableSize] = f;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  sem_post(&memmutex);
+  mergeNanos += (t1.tv_sec - t0.tv_sec) * 1000000000L +
+                (t1.tv_nsec - t0.tv_nsec);
+}
+
+// #frames the copy-on-write sharing (merged or forked pages) saves now
+int shared_cow_savings ()
+{ int f, saved = 0;
+
+  for (f = OSpages; f < numFrames; f++)
+    if (memFrame[f].shared == sharedCOW) saved += memFrame[f].refs - 1;
+  return (saved);
+}
+
+void initialize_merging ()
+{
+  mergeTableSize = numFrames;
+  mergeTable = (int *) malloc (mergeTableSize * sizeof(int));
+  mergeNext = (int *) malloc (numFrames * sizeof(int));
+  mergeKey = (unsigned *) malloc (numFrames * sizeof(unsigned));
+  mergeCursor = OSpages;
+}
+
+//==========================================
+// readahead
+// a fault on page raNext of a process continues a sequential run: the
+// pages after the previous fault (and its readahead) have been used in
+// order.  Then the readahead window doubles (1, 2, 4, .. readAheadMax),
+// otherwise it is halved.  The window's pages that are on disk, up to
+// the first one that is not, are marked pending and read with the faulting
+// page in one swap request, i.e. one disk IO.
+// a page read ahead does not count as referenced for the clock; it is a
+// hit when it is accessed, a waste when its frame is taken before that
+//==========================================
+
+// returns the #pages following page to be read with it, at most a
+// quarter of the user frames, so readahead cannot flush the working set
+int readahead_window (int pid, int page)
+{ int n = 0, limit = (numFrames - OSpages) / 4;
+
+  if (readAheadMax == 0) return (0);
+  if (page == PCB[pid]->raNext)
+  { PCB[pid]->raWindow = 2 * PCB[pid]->raWindow;
+    if (PCB[pid]->raWindow == 0) PCB[pid]->raWindow = 1;
+    if (PCB[pid]->raWindow > readAheadMax) PCB[pid]->raWindow = readAheadMax;
+  }
+  else PCB[pid]->raWindow = PCB[pid]->raWindow / 2;
+  while (n < PCB[pid]->raWindow && n < limit && page+n+1 < maxPpages &&
+         get_pagetable_entry(pid, page+n+1) == diskPage)
+  { update_process_pagetable(pid, page+n+1, pendingPage);
+    n++;
+  }
+  PCB[pid]->raNext = page + n + 1;
+  return (n);
+}
+
+// swap.c has read a page ahead into frame, it is installed if it is
+// still pending
+void install_readahead_frame (int frame, int pid, int page)
+{
+  if (get_pagetable_entry(pid, page) != pendingPage)
+  { release_frame (frame); return; }
+  install_frame (frame, pid, page, 0);
+  sem_wait (&memmutex);
+  if (get_pagetable_entry(pid, page) == frame)   // unless the daemon took it
+  { memFrame[frame].ref = 0;
+    memFrame[frame].ra = 1;
+  }
+  sem_post (&memmutex);
+  numRAPages++;
+}
+
+//==========================================
+// page-fault-frequency frame allocation
+// each process has an allowance of frames: a page fault within
+// pffThreshold cycles of the process's cpu time since its previous fault
+// raises it by one, a later fault lowers it by one (not below
+// pffMinFrames).  The clock takes the frames of processes over their
+// allowance first, and a process at its allowance replaces its own frames,
+// so one thrashing process mainly competes with itself.
+// resident counts the frames a process owns (not the shared frames it only
+// maps), it changes whenever a frame changes owner
+//==========================================
+
+// resident and allowance only change here, numOverAllowance stays in step
+void change_frame_use (int pid, int dresident, int dallowance)
+{ typePCB *p;
+
+  if (pffThreshold == 0 || pid <= idlePid) return;
+  sem_wait (&pffmutex);
+  p = PCB[pid];
+  if (p != NULL)
+  { if (p->resident > p->allowance) numOverAllowance--;
+    p->resident += dresident;
+    p->allowance += dallowance;
+    if (p->resident > p->allowance) numOverAllowance++;
+  }
+  sem_post (&pffmutex);
+}
+
+// pid has used up its allowance, it has to replace its own frames
+int pff_local_victim (int pid)
+{
+  if (pffThreshold == 0 || pid <= idlePid || PCB[pid] == NULL) return (0);
+  return (PCB[pid]->resident >= PCB[pid]->allowance);
+}
+
+// findex may be taken for a fault of pid
+int pff_victim (int findex, int pid, int local)
+{ int owner = memFrame[findex].pid;
+
+  if (local && owner == pid) return (1);
+  if (owner <= idlePid || PCB[owner] == NULL) return (1);
+  return (PCB[owner]->resident > PCB[owner]->allowance);
+}
+
+// called on each page fault of pid, adjust its allowance
+void pff_fault (int pid)
+{ int now, limit = numFrames - OSpages;
+
+  if (pffThreshold == 0) return;
+  now = PCB[pid]->timeUsed + CPU.numCycles - PCB[pid]->stateTime;
+  if (now - PCB[pid]->pffLast < pffThreshold)
+  { if (PCB[pid]->allowance < limit) change_frame_use (pid, 0, 1); }
+  else if (PCB[pid]->allowance > pffMinFrames) change_frame_use (pid, 0, -1);
+  PCB[pid]->pffLast = now;
+}
+
+//==========================================
+// page-out daemon
+// keeps the free list between freeLowWater and freeHighWater frames:
+// get_free_frame wakes it up when it leaves fewer than freeLowWater free
+// frames (posting pageoutWake only if the daemon is not awake already, so
+// it is not woken again for every frame it hands out), and it frees the victims of the replacement policy (queueing the
+// write-back of dirty ones, freed once written) till there are
+// freeHighWater free frames, counting those being written back.
+// So a fault normally finds a free frame and reserve_frame does not
+// evict on the swap thread.  memmutex is taken per victim, the swap thread
+// is never held up for a whole refill.
+//==========================================
+
+pthread_t pageoutThread;
+
+void *pageout_daemon (void *dummy)
+{ int frame;
+
+  while (systemActive)
+  { sem_wait (&pageoutWake);
+    while (systemActive)
+    { sem_wait (&memmutex);
+      // a frame being written back is free soon
+      if (numFreeFrames + numPagingOut >= freeHighWater) frame = nullIndex;
+      else frame = select_victim_frame (nullPid);
+      if (frame != nullIndex)
+      { if (evict_frame (frame, 0)) addto_free_frame (frame, nullPage);
+        numPageOuts++;
+      }
+      else pageoutAwake = 0;   // the next drop below freeLowWater wakes it
+      sem_post (&memmutex);
+      if (frame == nullIndex) break;
+    }
+  }
+  return (NULL);
+}
+
+void start_pageout_daemon ()
+{ int ret;
+
+  if (freeLowWater == 0) return;
+  ret = pthread_create (&pageoutThread, NULL, pageout_daemon, NULL);
+  if (ret != 0) { printf ("Page-out daemon creation problem.\n"); exit (1); }
+}
+
+void end_pageout_daemon ()
+{
+  if (freeLowWater == 0) return;
+  sem_post (&pageoutWake);
+  pthread_join (pageoutThread, NULL);
+  printf ("Page-out daemon has terminated.\n");
+}
+
 //==========================================
 // the major functions for paging, invoked externally
 //==========================================
@@ -665,7 +1713,7 @@ void page_fault_handler (unsigned pFaultTypeBit)
   // context switch On a page fault, the state of the faulting program is saved and the O.S.takes over
 	// via process.c (TODO)
 	// get_free_frame should be called only once, upon load to memory
-  // the select_agest_frame should also be in load_page_to_memory
+  // the select_clock_frame should also be in load_page_to_memory
   // SO what does this do? Basically it just sends the page request to swapQ
   // Then load_page_to_memory does its best to load the page, and swap out if needed
 	
@@ -678,46 +1726,127 @@ void page_fault_handler (unsigned pFaultTypeBit)
   }
 	pagein = pagein / pageSize;
 	int pidin = CPU.Pid;
+  int frame;
+  numPageFaults++;
+  note_profile_page(pidin, pagein);
+  pff_fault(pidin);
+  // a write to a copy-on-write page (or the page is in already)
+  frame = get_pagetable_entry(pidin, pagein);
+  if(frame >= 0){
+    sem_wait(&memmutex);
+    if(memFrame[frame].shared == sharedCOW && memFrame[frame].refs > 1){
+      sem_post(&memmutex);
+      numCOWFaults++;
+      insert_swapQ(pidin, pagein, NULL, actCopyPage, toReady);
+      return;
+    }
+    if(memFrame[frame].shared == sharedCOW) memFrame[frame].shared = notShared;
+    sem_post(&memmutex);
+    insert_endWait_process(pidin);
+    set_interrupt(endWaitInterrupt);
+    return;
+  }
+  // a demand-zero page is created in memory, nothing to read
+  // (swap.c does it, so that frames are only handed out on its thread)
+  if(get_pagetable_entry(pidin, pagein) == zeroPage){
+    update_process_pagetable(pidin, pagein, pendingPage);
+    insert_swapQ(pidin, pagein, NULL, actZeroFill, toReady);
+    return;
+  }
+  // a text page already in memory for another process needs no disk read
+  if(share_text_page(pidin, pagein)){
+    insert_endWait_process(pidin);
+    set_interrupt(endWaitInterrupt);
+    return;
+  }
   update_process_pagetable(CPU.Pid, pagein, pendingPage);
-	insert_swapQ(pidin, pagein, NULL, actRead, toReady);
+	insert_swapQ_pages(pidin, pagein, NULL, 1 + readahead_window(pidin, pagein),
+                     actRead, toReady);
 }
 
-// scan the memory and update the age field of each frame
-void memory_agescan ()
-{ int frameIndex;
-  for(frameIndex = OSpages; frameIndex < numFrames; frameIndex++){
-    // if frame is free, don't bother with it
-    // otherwise, we need to shift the bits
-    if(memFrame[frameIndex].free == usedFrame){
-      memFrame[frameIndex].age = memFrame[frameIndex].age >> 1;
-      // Do I need to free the pages if they are too old here?
-      // I have a feeling that I do have to
-      if(memFrame[frameIndex].age == 0){
-        // since frame is old, we'll need to swap it out to swap.disk
-        // free page
-        FrameStruct frame = memFrame[frameIndex];
-        if(frame.dirty == dirtyFrame){
-          int j = 0;
-          int i;
-          mType *outbuf = (mType*) malloc(pageSize * sizeof(mType));
-          for (i = frameIndex * pageSize; i < (frameIndex + 1) * pageSize; i++) {
-            outbuf[j] = Memory[i];
-            j++;
-          }
-          // update_process_pagetable(frame.pid, frame.page, diskPage);
-          update_process_pagetable(frame.pid, frame.page, pendingPage);
-          insert_swapQ(frame.pid, frame.page, (unsigned *)outbuf, actWrite, freeBuf);
-        } else {
-          update_process_pagetable(frame.pid, frame.page, diskPage);
-        }
-        addto_free_frame(frameIndex, nullPage);
-      }
+// a frame whose age has dropped to zero is freed, written back if dirty
+void free_old_frame (int frameIndex)
+{
+  // a frame just taken off the free list has no owner till swap.c
+  // has loaded the page, and a pinned one has swap IO pending, leave them
+  if(memFrame[frameIndex].free == usedFrame && frameAge[frameIndex] == zeroAge
+     && memFrame[frameIndex].pid != nullPid
+     && memFrame[frameIndex].pinned == nopinFrame){
+    // since frame is old, we'll need to swap it out to swap.disk
+    // free page, a dirty one once swap.c has written it
+    FrameStruct frame = memFrame[frameIndex];
+    if(frame.dirty == dirtyFrame){
+      page_out_frame(frameIndex);
+    } else {
+      update_process_pagetable(frame.pid, frame.page, clean_page_entry(frameIndex));
+      addto_free_frame(frameIndex, nullPage);
     }
   }
 }
 
+// the age scan is split into ageScanTicks chunks, one per age interrupt,
+// ageScanInterval cycles apart, ageScanTicks*ageScanInterval = periodAgeScan
+// so every frame is still aged exactly once per periodAgeScan, while an
+// interrupt only scans at most ageScanChunk frames (see below)
+// free frames always have zeroAge, so all frames in a chunk are shifted;
+// whole ageWords are shifted at once, the bit an age gets from its
+// neighbour is masked off, and the ages of a word are only looked at one
+// by one when one of them is zero (the word is swapped in atomically, swap.c
+// may be setting the age of a frame it has just loaded)
+void memory_agescan ()
+{ int frameIndex, first, last, k;
+  long numUser = numFrames - OSpages;
+  ageWord *words = (ageWord *) frameAge;
+  ageWord old, w;
+
+  first = OSpages + (int) (numUser * ageScanCursor / ageScanTicks);
+  last = OSpages + (int) (numUser * (ageScanCursor+1) / ageScanTicks);
+  frameIndex = first;
+  sem_wait (&memmutex);
+  for (; frameIndex < last && frameIndex % agesPerWord != 0; frameIndex++)
+  { frameAge[frameIndex] = frameAge[frameIndex] >> 1;
+    free_old_frame(frameIndex);
+  }
+  for (; frameIndex + agesPerWord <= last; frameIndex += agesPerWord)
+  { do
+    { old = words[frameIndex/agesPerWord];
+      w = (old >> 1) & ~ageHighs;
+    } while (!__sync_bool_compare_and_swap
+               (&words[frameIndex/agesPerWord], old, w));
+    if ((w - ageOnes) & ~w & ageHighs)
+      for (k = 0; k < agesPerWord; k++) free_old_frame(frameIndex+k);
+  }
+  for (; frameIndex < last; frameIndex++)
+  { frameAge[frameIndex] = frameAge[frameIndex] >> 1;
+    free_old_frame(frameIndex);
+  }
+  sem_post (&memmutex);
+  ageScanCursor = (ageScanCursor + 1) % ageScanTicks;
+  merge_scan ();
+}
+
+// pick the chunking: at most ageScanChunk frames per interrupt, the fewest
+// chunks that divide periodAgeScan.  One interrupt per cycle at most, so
+// with more than ageScanChunk*periodAgeScan user frames the chunk stays
+// bounded and a sweep takes longer than periodAgeScan (one chunk a cycle)
 void start_periodical_page_scan ()
-{ add_timer (periodAgeScan, osPid, actAgeInterrupt, periodAgeScan);
+{ int numUser = numFrames - OSpages;
+
+  ageScanTicks = 1;  ageScanInterval = periodAgeScan;
+  if (ageScanChunk > 0 && numUser > ageScanChunk)
+  { ageScanTicks = (numUser + ageScanChunk - 1) / ageScanChunk;
+    if (ageScanTicks >= periodAgeScan)
+    { ageScanInterval = 1;
+      if (ageScanTicks > periodAgeScan)
+        printf ("Age scan of %d frames takes %d cycles, not %d\n",
+                numUser, ageScanTicks, periodAgeScan);
+    }
+    else
+    { while (periodAgeScan % ageScanTicks != 0) ageScanTicks++;
+      ageScanInterval = periodAgeScan / ageScanTicks;
+    }
+  }
+  add_timer (ageScanInterval, osPid, actAgeInterrupt, ageScanInterval);
 }
 
 
@@ -725,6 +1854,11 @@ void initialize_memory_manager ()
 { 
   // initialize memory and add page scan event request
   initialize_memory();
+  sem_init(&textmutex, 0, 1);
+  sem_init(&pffmutex, 0, 1);
+  sem_init(&memmutex, 0, 1);
+  sem_init(&pageoutWake, 0, 0);
+  initialize_replacement();
   start_periodical_page_scan();
 }
 
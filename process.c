@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include "simos.h"
@@ -15,6 +16,11 @@
 int currentPid = 2;    // user pid should start from 2, pid=0/1 are OS/idle
 int numUserProcess = 0; 
 
+// pids of terminated processes are recycled in FIFO order, so that a
+// large maxProcess only bounds the #live processes, not the #submissions
+int *freePids;
+int freePidHead = 0, numFreePids = 0;
+
 //============================================
 // context switch, switch in or out a process pid
 
@@ -42,6 +48,59 @@ void context_out (int pid, int intime, int pageFault)
   PCB[pid]->numPF = PCB[pid]->numPF + pageFault;
 }
 
+//=========================================================================
+// Process accounting
+// Each PCB records when it entered its current waiting state, when it
+// leaves that state the elapsed cycles are charged to the matching total.
+// At process exit one CSV line per process is written to acctFN, so that
+// runs with different cpuQuantum or paging settings can be compared.
+//=========================================================================
+
+#define acctFN "account.out"
+FILE *facct;
+
+#define eTermWait 5   // waitKind only: eWait for the terminal queue
+
+// charge the time spent in the current state and enter state kind
+void account_enter_state (int pid, int kind)
+{ int elapsed;
+
+  if (pid <= idlePid || PCB[pid] == NULL) return;
+  elapsed = CPU.numCycles - PCB[pid]->stateTime;
+  switch (PCB[pid]->waitKind)
+  { case eReady: PCB[pid]->readyTime += elapsed; break;
+    case eWait: PCB[pid]->sleepTime += elapsed; break;
+    case ePFault: PCB[pid]->pfaultTime += elapsed; break;
+    case eTermWait: PCB[pid]->termTime += elapsed; break;
+    default: break;   // eRun, cpu time is accounted in timeUsed
+  }
+  PCB[pid]->waitKind = kind;
+  PCB[pid]->stateTime = CPU.numCycles;
+}
+
+void initialize_accounting ()
+{
+  facct = fopen (acctFN, "w");
+  if (facct == NULL) { perror ("Error open accounting file: "); return; }
+  fprintf (facct, "pid,status,submit,dispatch,end,turnaround,response,");
+  fprintf (facct, "cpu,ready,sleep,pfault,term,cswitch,pfault_count\n");
+  fflush (facct);
+}
+
+void write_accounting (int pid)
+{ typePCB *p = PCB[pid];
+
+  if (facct == NULL) return;
+  fprintf (facct, "%d,%s,%d,%d,%d,%d,%d,", pid,
+           (p->exeStatus == eError) ? "error" : "end",
+           p->submitTime, p->dispatchTime, p->endTime,
+           p->endTime - p->submitTime, p->dispatchTime - p->submitTime);
+  fprintf (facct, "%d,%d,%d,%d,%d,%d,%d\n", p->timeUsed, p->readyTime,
+           p->sleepTime, p->pfaultTime, p->termTime, p->numCS, p->numPF);
+  fflush (facct);
+}
+
+
 //=========================================================================
 // ready queue management
 // Implemented as a linked list with head and tail pointers
@@ -60,26 +119,32 @@ typedef struct ReadyNodeStruct
 ReadyNode *readyHead = NULL;
 ReadyNode *readyTail = NULL;
 
+// the cpu thread inserts and removes, the admin thread dumps the queue
+sem_t rmutex;
 
 void insert_ready_process (pid)
 int pid;
 { ReadyNode *node;
-    printf("%d inserting into readyQ\n", pid);
+  if (Debug) printf("%d inserting into readyQ\n", pid);
   node = (ReadyNode *) malloc (sizeof (ReadyNode));
   node->pid = pid;
   node->next = NULL;
+  sem_wait (&rmutex);
   if (readyTail == NULL) // readyHead would be NULL also
     { readyTail = node; readyHead = node; }
   else // insert to tail
     { readyTail->next = node; readyTail = node; }
-    printf("%d inserted into readyQ\n", pid);
+  sem_post (&rmutex);
+  if (Debug) printf("%d inserted into readyQ\n", pid);
 }
 
 int get_ready_process ()
 { ReadyNode *rnode;
   int pid;
+  sem_wait (&rmutex);
   if (readyHead == NULL)
-  { printf ("No ready process now!!!\n");
+  { sem_post (&rmutex);
+    if (cpuDebug) printf ("No ready process now!!!\n");
     return (nullReady); 
   }
   else
@@ -89,9 +154,10 @@ int get_ready_process ()
     free (rnode);
     if (readyHead == NULL) readyTail = NULL;
   }
+  sem_post (&rmutex);
 
   if(PCB[pid] == NULL){
-    return get_ready_process();
+    return get_ready_process();   // tail call, no deep recursion
   } else {
     return (pid);
   }
@@ -101,8 +167,10 @@ void dump_ready_queue ()
 { ReadyNode *node;
 
   printf ("******************** Ready Queue Dump\n");
+  sem_wait (&rmutex);
   node = readyHead;
   while (node != NULL) { printf ("%d, ", node->pid); node = node->next; }
+  sem_post (&rmutex);
   printf ("\n");
 }
 
@@ -149,6 +217,7 @@ void endWait_moveto_ready ()
   sem_wait (&pmutex);
   while (endWaitHead != NULL)
   { node = endWaitHead;
+    account_enter_state (node->pid, eReady);
     insert_ready_process (node->pid);
     PCB[node->pid]->exeStatus = eReady;
     endWaitHead = node->next;
@@ -161,9 +230,11 @@ void endWait_moveto_ready ()
 void dump_endWait_list ()
 { EndWaitNode *node;
 
+  sem_wait (&pmutex);
   node = endWaitHead;
   printf ("endWait List = ");
   while (node != NULL) { printf ("%d, ", node->pid); node = node->next; }
+  sem_post (&pmutex);
   printf ("\n");
 }
 
@@ -173,28 +244,102 @@ void dump_endWait_list ()
 //=========================================================================
 
 void init_PCB_ptrarry ()
-{ PCB = (typePCB **) malloc (maxProcess*addrSize); }
+{ int pid;
+
+  PCB = (typePCB **) malloc (maxProcess*sizeof(typePCB *));
+  for (pid=0; pid<maxProcess; pid++) PCB[pid] = NULL;
+  freePids = (int *) malloc (maxProcess*sizeof(int));
+  freePidHead = 0;  numFreePids = 0;
+}
+
+// loader threads in submit.c create processes concurrently
+sem_t pidmutex;
+
+// the admin dumps walk the PCBs and their page tables while the cpu thread
+// ends processes and the loaders create them: a PCB is set up, and a
+// process freed, holding pcbmutex, the dumps hold it throughout
+sem_t pcbmutex;
+
+void hold_PCBs ()
+{ sem_wait (&pcbmutex); }
+
+void release_PCBs ()
+{ sem_post (&pcbmutex); }
 
 int new_PCB ()
 { int pid;
 
-  pid = currentPid;
-  currentPid++;
-  if (pid >= maxProcess)
-  { printf ("Exceeding maximum number of processes: %d\n", pid);
+  sem_wait (&pidmutex);
+  if (numFreePids > 0)
+  { pid = freePids[freePidHead];
+    freePidHead = (freePidHead + 1) % maxProcess;
+    numFreePids--;
+  }
+  else if (currentPid >= maxProcess)
+  { printf ("Exceeding maximum number of processes: %d\n", currentPid);
+    sem_post (&pidmutex);
     return (-1);
   }
+  else
+  { pid = currentPid;
+    currentPid++;
+  }
+  sem_post (&pidmutex);
+  sem_wait (&pcbmutex);
   PCB[pid] = (typePCB *) malloc ( sizeof(typePCB) );
   PCB[pid]->Pid = pid;
+  // loader threads stage it while the cpu runs, it is readied by swap.c
+  PCB[pid]->PC = 0;
+  PCB[pid]->AC = 0;
+  PCB[pid]->exeStatus = eReady;
+  PCB[pid]->timeUsed = 0;
+  PCB[pid]->numPF = 0;
+  PCB[pid]->submitTime = CPU.numCycles;
+  PCB[pid]->dispatchTime = -1;
+  PCB[pid]->endTime = -1;
+  PCB[pid]->readyTime = 0;
+  PCB[pid]->sleepTime = 0;
+  PCB[pid]->pfaultTime = 0;
+  PCB[pid]->termTime = 0;
+  PCB[pid]->numCS = 0;
+  PCB[pid]->stateTime = CPU.numCycles;
+  PCB[pid]->waitKind = ePFault;   // the initial load is a burst of page faults
+  PCB[pid]->quantum = cpuQuantum;   // in the adaptive bounds from the start
+  if (PCB[pid]->quantum > maxQuantum) PCB[pid]->quantum = maxQuantum;
+  if (PCB[pid]->quantum < minQuantum) PCB[pid]->quantum = minQuantum;
+  PCB[pid]->suspend = 0;
+  PCB[pid]->windowPF = 0;
+  PCB[pid]->windowId = -1;
+  PCB[pid]->swapSet = NULL;
+  PCB[pid]->numSwapSet = 0;
+  PCB[pid]->textGroup = nullIndex;
+  PCB[pid]->progName = NULL;
+  PCB[pid]->profile = NULL;
+  PCB[pid]->numProfile = 0;
+  PCB[pid]->raNext = nullIndex;
+  PCB[pid]->raWindow = 0;
+  PCB[pid]->resident = 0;
+  PCB[pid]->allowance = (loadPpages > pffMinFrames) ? loadPpages : pffMinFrames;
+  PCB[pid]->pffLast = 0;
   init_process_pagetable(pid);
+  sem_post (&pcbmutex);
   return (pid);
 }
 
 void free_PCB (int pid)
 {
+  free (PCB[pid]->progName);
+  free (PCB[pid]->profile);
+  free_process_pagetable (pid);
   free (PCB[pid]);
   if (Debug) printf ("Free PCB: %d\n", PCB[pid]);
   PCB[pid] = NULL;
+  if (pid > idlePid)
+  { sem_wait (&pidmutex);
+    freePids[(freePidHead + numFreePids) % maxProcess] = pid;
+    numFreePids++;
+    sem_post (&pidmutex);
+  }
 }
 
 void dump_PCB (int pid)
@@ -208,25 +353,166 @@ void dump_PCB (int pid)
   printf ("exeStatus = %d\n", PCB[pid]->exeStatus);
   printf ("Time used: %d\n", PCB[pid]->timeUsed);
   printf ("Number of Page Faults %d\n", PCB[pid]->numPF);
+  printf ("Submit/dispatch time = %d/%d\n",
+          PCB[pid]->submitTime, PCB[pid]->dispatchTime);
+  printf ("Ready/sleep/pfault/term time = %d/%d/%d/%d\n",
+          PCB[pid]->readyTime, PCB[pid]->sleepTime,
+          PCB[pid]->pfaultTime, PCB[pid]->termTime);
+  printf ("Context switches: %d\n", PCB[pid]->numCS);
+  printf ("Time quantum: %d\n", PCB[pid]->quantum);
+  if (pffThreshold > 0)
+    printf ("Resident frames/allowance: %d/%d\n",
+            PCB[pid]->resident, PCB[pid]->allowance);
 }
 
-void dump_PCB_list ()
-{ int pid;
+// with many processes the dumps are paginated, each call dumps at most
+// dumpPageProcess processes starting from pid from
+void dump_PCB_list (int from)
+{ int pid, count = 0;
+
+  if (from < idlePid) from = idlePid;
+  printf ("Dump PCB: From %d, %d user processes in the system\n",
+          from, numUserProcess);
+  sem_wait (&pcbmutex);
+  for (pid=from; pid<currentPid && count<dumpPageProcess; pid++)
+    if (PCB[pid] != NULL) { dump_PCB (pid); count++; }
+  sem_post (&pcbmutex);
+  if (pid < currentPid) printf ("More processes, continue from pid %d\n", pid);
+}
 
-  printf ("Dump all PCB: From 0 to %d\n", currentPid);
-  for (pid=idlePid; pid<currentPid; pid++)
-    if (PCB[pid] != NULL) dump_PCB (pid);
+void dump_PCB_memory (int from)
+{ int pid, count = 0;
+
+  if (from < idlePid) from = idlePid;
+  printf ("Dump memory/swap of processes: From %d\n", from);
+  sem_wait (&pcbmutex);
+  for (pid=from; pid<currentPid && count<dumpPageProcess; pid++)
+    if (PCB[pid] != NULL) { dump_process_memory (pid); count++; }
+  sem_post (&pcbmutex);
+  if (pid < currentPid) printf ("More processes, continue from pid %d\n", pid);
 }
 
-void dump_PCB_memory ()
-{ int pid;
 
-  printf ("Dump memory/swap of all processes: From 1 to %d\n", currentPid-1);
-  dump_process_memory (idlePid);
-  for (pid=idlePid+1; pid<currentPid; pid++)
-    if (PCB[pid] != NULL) dump_process_memory (pid);
+//=========================================================================
+// Medium-term scheduler
+// Every mtsWindow cycles the number of page faults in the system is
+// checked.  If it is above mtsHighPF, the system is thrashing and the
+// process with the most faults in the window is marked for suspension.
+// It is suspended when it reaches the head of the ready queue (so it has
+// no IO in progress): its dirty frames are written back, all its frames
+// are released and it is put in the suspended list.  When the fault rate
+// drops below mtsLowPF and there are enough free frames, the first
+// suspended process gets its resident pages back as a batch of reads.
+//=========================================================================
+
+#define noSuspend 0
+#define suspendPending 1   // marked, will be suspended when dispatched
+#define suspended 2
+
+ReadyNode *suspendHead = NULL;
+ReadyNode *suspendTail = NULL;
+int numSuspended = 0;
+
+int mtsStart = 0;    // when the current window started
+int mtsFaults = 0;   // #page faults in the current window
+int mtsWindowId = 0; // PCB windowPF only counts if PCB windowId matches
+int mtsVictim = nullPid;  // process with the most faults in the window
+
+// count a page fault of pid, keep track of the top faulting process
+// so that no scan over all processes is needed
+void count_window_fault (int pid)
+{
+  if (PCB[pid]->windowId != mtsWindowId)
+  { PCB[pid]->windowId = mtsWindowId;
+    PCB[pid]->windowPF = 0;
+  }
+  PCB[pid]->windowPF++;
+  mtsFaults++;
+  if (PCB[pid]->suspend != noSuspend) return;
+  if (mtsVictim == nullPid || PCB[mtsVictim] == NULL ||
+      PCB[mtsVictim]->windowId != mtsWindowId ||
+      PCB[pid]->windowPF > PCB[mtsVictim]->windowPF)
+    mtsVictim = pid;
+}
+
+void suspend_process (int pid)
+{ ReadyNode *node;
+
+  // the swap set is allocated by paging.c, merged pages share frames
+  PCB[pid]->numSwapSet = swapout_process_memory (pid, &PCB[pid]->swapSet);
+  PCB[pid]->suspend = suspended;
+  node = (ReadyNode *) malloc (sizeof (ReadyNode));
+  node->pid = pid;
+  node->next = NULL;
+  if (suspendTail == NULL) { suspendTail = node; suspendHead = node; }
+  else { suspendTail->next = node; suspendTail = node; }
+  numSuspended++;
+  printf ("Process %d suspended, %d pages swapped out\n",
+          pid, PCB[pid]->numSwapSet);
+}
+
+// bring the pages back in one batch, the last read sends pid to ready
+void resume_process (int pid)
+{ int i, page;
+
+  PCB[pid]->suspend = noSuspend;
+  numSuspended--;
+  for (i=0; i<PCB[pid]->numSwapSet; i++)
+  { page = PCB[pid]->swapSet[i];
+    update_process_pagetable (pid, page, pendingPage);
+    if (i < PCB[pid]->numSwapSet-1)
+      insert_swapQ (pid, page, NULL, actRead, Nothing);
+    else insert_swapQ (pid, page, NULL, actRead, toReady);
+  }
+  if (PCB[pid]->numSwapSet == 0)
+  { insert_endWait_process (pid);
+    set_interrupt (endWaitInterrupt);
+  }
+  printf ("Process %d resumed, %d pages swapped in\n",
+          pid, PCB[pid]->numSwapSet);
+  free (PCB[pid]->swapSet);
+  PCB[pid]->swapSet = NULL;
+  PCB[pid]->numSwapSet = 0;
+}
+
+// called at each dispatch, only does work once per window
+void medium_term_schedule ()
+{ int pid, victim;
+  ReadyNode *node;
+
+  if (mtsWindow <= 0 || CPU.numCycles - mtsStart < mtsWindow) return;
+  if (mtsFaults > mtsHighPF && numUserProcess - numSuspended > 1)
+  { victim = mtsVictim;
+    if (victim != nullPid && PCB[victim] != NULL &&
+        PCB[victim]->suspend == noSuspend)
+    { PCB[victim]->suspend = suspendPending;
+      if (Debug) printf ("Thrashing: %d faults, suspend process %d\n",
+                         mtsFaults, victim);
+    }
+  }
+  else if (mtsFaults < mtsLowPF && suspendHead != NULL &&
+           count_free_frames() >= PCB[suspendHead->pid]->numSwapSet)
+  { node = suspendHead;
+    suspendHead = node->next;
+    if (suspendHead == NULL) suspendTail = NULL;
+    pid = node->pid;
+    free (node);
+    resume_process (pid);
+  }
+  mtsWindowId++;
+  mtsVictim = nullPid;
+  mtsStart = CPU.numCycles;
+  mtsFaults = 0;
 }
 
+void dump_suspended_list ()
+{ ReadyNode *node;
+
+  node = suspendHead;
+  printf ("Suspended List = ");
+  while (node != NULL) { printf ("%d, ", node->pid); node = node->next; }
+  printf ("\n");
+}
 
 //=========================================================================
 // process management
@@ -237,16 +523,37 @@ void dump_PCB_memory ()
 #define idleNinstr 2
 #define Pfault 1
 #define noPfault 0
+#define OPprint 7   // has to be consistent with cpu.c
+
+// adapt the time quantum of pid after it used the cpu for intime cycles
+// a process that used up its quantum is cpu bound, double its quantum
+// to cut context switch and timer overhead; a process that blocked
+// (OPprint, OPsleep, page fault) early in its quantum gets half of it,
+// so that it comes back to the cpu sooner
+void adapt_quantum (int pid, int intime)
+{ int q = PCB[pid]->quantum;
+
+  if (CPU.exeStatus == eReady) q = q * 2;
+  else if (intime < q / 2) q = q / 2;
+  if (q > maxQuantum) q = maxQuantum;
+  if (q < minQuantum) q = minQuantum;
+  PCB[pid]->quantum = q;
+}
 
 void clean_process (int pid)
 {
+  sem_wait (&pcbmutex);   // not while a dump looks at the process
   free_process_memory (pid);
   free_PCB (pid);  // PCB has to be freed last, other frees use PCB info
+  sem_post (&pcbmutex);
 } 
 
 void end_process (int pid) { 
   PCB[pid]->exeStatus = CPU.exeStatus;
     // PCB[pid] is not updated, no point to do a full context switch
+  account_enter_state (pid, eEnd);
+  PCB[pid]->endTime = CPU.numCycles;
+  write_accounting (pid);
 
   // send end process print msg to terminal, str will be freed by terminal
   char *str = (char *) malloc (80);
@@ -261,16 +568,37 @@ void end_process (int pid) {
     //          pid, PCB[pid]->timeUsed, PCB[pid]->numPF);
     sprintf (str, "Process %d had completed successfully: Time=%d, PF=%d\n",
              pid, PCB[pid]->timeUsed, PCB[pid]->numPF);
+    write_profile (pid);
   }
   insert_termio (pid, str, endIO);
 
   // invoke io to print str, process has terminated, so no wait state
-  numUserProcess--;
+  __sync_fetch_and_sub (&numUserProcess, 1);
   clean_process (pid); 
     // cpu will clean up process pid without waiting for printing to finish
     // so, io should not access PCB[pid] for end process printing
 }
 
+// OPfork: the child is a copy of the running process, it starts at the
+// instruction after the fork with AC 0, the parent gets its pid in AC (-1 if
+// there is no pid left); they share their memory copy-on-write, see paging.c
+int fork_process (int ppid)
+{ int pid = new_PCB ();
+
+  if (pid < 0) return (-1);
+  PCB[pid]->PC = CPU.PC + 1;
+  PCB[pid]->AC = 0;
+  PCB[pid]->MDbase = CPU.MDbase;
+  PCB[pid]->exeStatus = eReady;
+  fork_process_memory (ppid, pid);
+  __sync_fetch_and_add (&numUserProcess, 1);
+  // the copy of its swap pages is queued, its page faults come after it
+  insert_endWait_process (pid);
+  set_interrupt (endWaitInterrupt);
+  if (Debug) printf ("Process %d forked process %d\n", ppid, pid);
+  return (pid);
+}
+
 // this function initializes the idle process
 // idle process has only 1 instruction, ifgo (2 words) and 1 data
 // the ifgo condition is always true and will always go back to 0
@@ -282,6 +610,11 @@ void init_idle_process ()
   PCB[idlePid]->Pid = idlePid;  // idlePid = 1, set in ???
   PCB[idlePid]->PC = 0;
   PCB[idlePid]->AC = 0;
+  PCB[idlePid]->quantum = idleQuantum;
+  PCB[idlePid]->textGroup = nullIndex;
+  PCB[idlePid]->progName = NULL;
+  PCB[idlePid]->profile = NULL;
+  PCB[idlePid]->numProfile = 0;
   load_idle_process ();
   if (Debug) { dump_PCB (idlePid); dump_process_memory (idlePid); }
 }
@@ -294,7 +627,11 @@ void initialize_process_manager ()
   numUserProcess = 0;  // the actual number of processes in the system
 
   init_idle_process ();
+  initialize_accounting ();
   sem_init (&pmutex, 0, 1);
+  sem_init (&rmutex, 0, 1);
+  sem_init (&pidmutex, 0, 1);
+  sem_init (&pcbmutex, 0, 1);
 }
 
 // submit_process always working on a new pid and the new pid will not be 
@@ -312,16 +649,15 @@ int submit_process (char *fname)
     pid = new_PCB ();
     if (pid > idlePid)
     { int dataOffset;
+      // PC, AC and exeStatus are set by new_PCB, the process may run as
+      // soon as its first pages are in, before load_process returns
+      // loader.c will fill in MDbase since we need it before putting any pages into memory
+      // swap manager will put the process to ready queue
+      __sync_fetch_and_add (&numUserProcess, 1);
       ret = load_process (pid, fname);   // return #pages loaded
-      if (ret > 0)
-      { PCB[pid]->PC = 0;
-        PCB[pid]->AC = 0;
-        PCB[pid]->exeStatus = eReady;
-        // loader.c will fill in MDbase since we need it before putting any pages into memory
-        // swap manager will put the process to ready queue
-        numUserProcess++;
-        return (pid);
-      } else clean_process(pid);
+      if (ret > 0) return (pid);
+      __sync_fetch_and_sub (&numUserProcess, 1);
+      clean_process(pid);
       //else free_PCB (pid);   // cannot clean_process(), no page table
   } //}
   // abnormal situation, PCB has not been allocated or has been freed
@@ -335,27 +671,50 @@ int submit_process (char *fname)
 void execute_process ()
 { int pid, intime;
   genericPtr event;
+  medium_term_schedule ();
   pid = get_ready_process ();
+  while (pid != nullReady && PCB[pid]->suspend == suspendPending)
+  { suspend_process (pid);
+    pid = get_ready_process ();
+  }
   if (pid != nullReady)
   { 
     // *** ADD CODE to perform context switch and call cpu_execution
     // also add code to keep track of accounting info: timeUsed & numPF
+    account_enter_state (pid, eRun);
+    if (PCB[pid]->dispatchTime < 0) PCB[pid]->dispatchTime = CPU.numCycles;
+    PCB[pid]->numCS++;
     context_in(pid);
     intime = CPU.numCycles;
     CPU.exeStatus = eRun;
-    event = add_timer (cpuQuantum, CPU.Pid, actTQinterrupt, oneTimeTimer);
+    event = add_timer (PCB[pid]->quantum, CPU.Pid, actTQinterrupt,
+                       ownedTimer);
     cpu_execution ();
+    // the quantum timer is owned, it is released whether it expired or not;
+    // if it expired in the very last cycle, its interrupt is still pending
+    // and must not stop the next process
+    deactivate_timer (event);
+    if (CPU.exeStatus != eReady) clear_interrupt (tqInterrupt);
     intime = CPU.numCycles - intime;
+    if (CPU.exeStatus != eError && CPU.exeStatus != eEnd)
+      adapt_quantum (pid, intime);
     if (CPU.exeStatus == eReady){
       context_out(pid, intime, noPfault);
+      account_enter_state (pid, eReady);
       insert_ready_process (pid);
     }
-    else if (CPU.exeStatus == ePFault || CPU.exeStatus == eWait) {
+    else if (CPU.exeStatus == ePFault) {
       context_out(pid, intime, Pfault);
-      deactivate_timer (event);
+      count_window_fault (pid);
+      account_enter_state (pid, ePFault);
+    }
+    else if (CPU.exeStatus == eWait) {
+      context_out(pid, intime, noPfault);
+      if (CPU.IRopcode == OPprint) account_enter_state (pid, eTermWait);
+      else account_enter_state (pid, eWait);
     }
     else // CPU.exeStatus == eError or eEnd
-      { end_process (pid); deactivate_timer (event); }
+      { end_process (pid); }
     // ePFault and eWait has to be handled differently
     // in ePFfault, interrupt is set and memory handles the interrupt
     // in eWait, CPU directly execute IO libraries and initiate IO
@@ -365,6 +724,7 @@ void execute_process ()
     // otherwise, it has the potential of impacting exe of next process
     // but if time quantum just expires when the above cases happends,
     // event would have just been freed, our deactivation can be dangerous
+    // (that is why the quantum timer is an ownedTimer, deactivated above)
   }
   else // no ready process in the system, so execute idle process
        // idle process will not have page fault, or go to wait state
@@ -379,3 +739,60 @@ void execute_process ()
 }
 
 
+//=========================================================================
+// The cpu thread
+// The simulated cpu runs on its own thread, so that the admin console
+// never waits for execution and dumps do not stall it.  The admin can
+// let it run continuously (cpu_run), stop it (cpu_pause) or request a
+// number of execute_process rounds (cpu_step).
+//=========================================================================
+
+pthread_t cpuThread;
+sem_t cpu_go;         // one post for each requested round
+int cpuRunning = 0;   // 1: run continuously, 0: only run requested rounds
+
+void *cpu_loop ()
+{
+  while (systemActive)
+  { if (cpuRunning) sem_trywait (&cpu_go);  // steps mean nothing now
+    else sem_wait (&cpu_go);
+    if (!systemActive) break;
+    execute_process ();
+    if (Debug) { dump_memoryframe_info(); dump_PCB_memory(idlePid); }
+    // a free running idle loop would race far ahead of the IO threads,
+    // which sleep in real time, so an idle quantum takes idleQuantum usec
+    if (cpuRunning && CPU.Pid == idlePid) usleep (idleQuantum);
+  }
+  if (Debug) printf ("CPU loop has ended\n");
+  return (NULL);
+}
+
+void cpu_step (int rounds)
+{ int i;
+  for (i=0; i<rounds; i++) sem_post (&cpu_go);
+}
+
+void cpu_run ()
+{ cpuRunning = 1;
+  sem_post (&cpu_go);   // wake up the cpu thread if it is waiting
+}
+
+void cpu_pause ()
+{ cpuRunning = 0; }
+
+void start_cpu ()
+{ int ret;
+
+  sem_init (&cpu_go, 0, 0);
+  ret = pthread_create (&cpuThread, NULL, cpu_loop, NULL);
+  if (ret < 0) printf ("CPU thread creation problem\n");
+  else printf ("CPU thread has been created successsfully\n");
+}
+
+void end_cpu ()
+{ int ret;
+
+  sem_post (&cpu_go);   // systemActive is 0, the cpu loop will end
+  ret = pthread_join (cpuThread, NULL);
+  printf ("CPU thread has terminated %d\n", ret);
+}
@@ -0,0 +1,263 @@
+//==========================================================
+// replace.c
+// Page replacement policies that keep their own frame lists (LRU, 2Q),
+// and the page reference trace for comparing policies offline (replsim.c)
+// The clock and aging policies work on the frame metadata in paging.c
+//==========================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include "simos.h"
+
+//==========================================
+// frame lists
+// LRU keeps the frames in reference order, least recent at the head.
+// 2Q (Johnson & Shasha) puts a newly loaded frame in A1, a FIFO, and only
+// moves a page to Am, an LRU list, when it is faulted in again shortly
+// after it was evicted from A1: A1out remembers the last pages evicted
+// from A1.  A1 is kept to a quarter of the user frames, so pages used once
+// (a scan) cannot flush the pages in Am.  LRU uses Am as its list.
+// frames are linked by frame index through lnext/lprev, lwhich tells the
+// list a frame is in; the lists change on the cpu thread (references) and
+// on the swap thread (loads, victims), so they are guarded by replmutex
+// A1out is a ring of pages, hashed by pid/page, so a load looks it up in
+// O(1) with any number of frames
+//==========================================
+
+#define notListed 0
+#define inAm 1
+#define inA1 2
+#define cleanScan 8   // a victim is the first clean frame among so many
+
+typedef struct
+{ int head, tail, count;
+} FrameList;
+
+int *lnext, *lprev;
+char *lwhich;
+FrameList Am, A1;
+int *A1outPid, *A1outPage;   // ring of the pages evicted from A1
+int A1outSize, A1outNext = 0;
+int *A1outHash;    // A1outHash[hash]: a slot of the ring, chained in A1outChain
+int *A1outChain;
+int A1outHashSize;
+int A1inMax;
+sem_t replmutex;
+
+void list_remove (FrameList *l, int f)
+{
+  if (lprev[f] == nullIndex) l->head = lnext[f];
+  else lnext[lprev[f]] = lnext[f];
+  if (lnext[f] == nullIndex) l->tail = lprev[f];
+  else lprev[lnext[f]] = lprev[f];
+  l->count--;
+  lwhich[f] = notListed;
+}
+
+void list_append (FrameList *l, int f, int which)
+{
+  lprev[f] = l->tail;
+  lnext[f] = nullIndex;
+  if (l->tail == nullIndex) l->head = f;
+  else lnext[l->tail] = f;
+  l->tail = f;
+  l->count++;
+  lwhich[f] = which;
+}
+
+void unlist_frame (int f)
+{
+  if (lwhich[f] == inAm) list_remove (&Am, f);
+  else if (lwhich[f] == inA1) list_remove (&A1, f);
+}
+
+int A1out_hash (int pid, int page)
+{ return ((((unsigned) pid * 2654435761u) ^ (unsigned) page) % A1outHashSize);
+}
+
+// slot k of the ring is emptied
+void A1out_unlink (int k)
+{ int *p = &A1outHash[A1out_hash (A1outPid[k], A1outPage[k])];
+
+  while (*p != k) p = &A1outChain[*p];
+  *p = A1outChain[k];
+  A1outPid[k] = nullPid;
+}
+
+// the page goes in the ring, in place of the oldest one
+void A1out_add (int pid, int page)
+{ int k = A1outNext, h = A1out_hash (pid, page);
+
+  if (A1outPid[k] != nullPid) A1out_unlink (k);
+  A1outPid[k] = pid;
+  A1outPage[k] = page;
+  A1outChain[k] = A1outHash[h];
+  A1outHash[h] = k;
+  A1outNext = (k + 1) % A1outSize;
+}
+
+void A1out_clear ()
+{ int k;
+
+  for (k = 0; k < A1outSize; k++) A1outPid[k] = nullPid;
+  for (k = 0; k < A1outHashSize; k++) A1outHash[k] = nullIndex;
+}
+
+// was the page evicted from A1 recently, if so it is forgotten
+int in_A1out (int pid, int page)
+{ int k;
+
+  for (k = A1outHash[A1out_hash (pid, page)]; k != nullIndex; k = A1outChain[k])
+    if (A1outPid[k] == pid && A1outPage[k] == page)
+    { A1out_unlink (k); return (1); }
+  return (0);
+}
+
+void replace_loaded (int findex, int pid, int page)
+{
+  if (replacePolicy != replLRU && replacePolicy != repl2Q) return;
+  sem_wait (&replmutex);
+  unlist_frame (findex);
+  if (replacePolicy == repl2Q && !in_A1out (pid, page))
+    list_append (&A1, findex, inA1);
+  else list_append (&Am, findex, inAm);
+  sem_post (&replmutex);
+}
+
+// a reference moves the frame to the tail of Am, a frame in A1 stays
+void replace_referenced (int findex)
+{
+  if (replacePolicy != replLRU && replacePolicy != repl2Q) return;
+  if (lwhich[findex] != inAm || Am.tail == findex) return;
+  sem_wait (&replmutex);
+  if (lwhich[findex] == inAm)
+  { list_remove (&Am, findex);
+    list_append (&Am, findex, inAm);
+  }
+  sem_post (&replmutex);
+}
+
+void replace_freed (int findex)
+{
+  if (lwhich[findex] == notListed) return;
+  sem_wait (&replmutex);
+  unlist_frame (findex);
+  sem_post (&replmutex);
+}
+
+// the first clean frame among the first cleanScan evictable frames from the
+// head of l, or else the first evictable one
+int scan_list (FrameList *l)
+{ int f, seen = 0, first = nullIndex;
+
+  for (f = l->head; f != nullIndex && seen < cleanScan; f = lnext[f])
+  { if (!frame_evictable (f)) continue;
+    if (!frame_dirty (f)) return (f);
+    if (first == nullIndex) first = f;
+    seen++;
+  }
+  return (first);
+}
+
+int select_listed_frame ()
+{ int f = nullIndex;
+
+  sem_wait (&replmutex);
+  if (replacePolicy == repl2Q && (A1.count > A1inMax || Am.count == 0))
+    f = scan_list (&A1);
+  if (f == nullIndex) f = scan_list (&Am);
+  if (f == nullIndex) f = scan_list (&A1);
+  if (f != nullIndex)
+  { if (lwhich[f] == inA1) A1out_add (frame_pid (f), frame_page (f));
+    unlist_frame (f);
+  }
+  sem_post (&replmutex);
+  return (f);
+}
+
+// the lists are rebuilt from the frames in use, in frame order
+void set_replacement_policy (int policy)
+{ int f;
+
+  if (policy < 0 || policy >= numPolicies)
+  { printf ("Incorrect replacement policy %d\n", policy); return; }
+  sem_wait (&replmutex);
+  Am.head = Am.tail = nullIndex;  Am.count = 0;
+  A1.head = A1.tail = nullIndex;  A1.count = 0;
+  for (f = 0; f < numFrames; f++) lwhich[f] = notListed;
+  A1out_clear ();
+  replacePolicy = policy;
+  if (policy == replLRU || policy == repl2Q)
+    for (f = OSpages; f < numFrames; f++)
+      if (frame_evictable (f)) list_append (&Am, f, inAm);
+  sem_post (&replmutex);
+}
+
+void dump_replacement_lists ()
+{ int f;
+
+  if (replacePolicy != replLRU && replacePolicy != repl2Q) return;
+  sem_wait (&replmutex);
+  printf ("Am (%d frames): ", Am.count);
+  for (f = Am.head; f != nullIndex; f = lnext[f]) printf ("%d ", f);
+  printf ("\n");
+  if (replacePolicy == repl2Q)
+  { printf ("A1 (%d frames, at most %d): ", A1.count, A1inMax);
+    for (f = A1.head; f != nullIndex; f = lnext[f]) printf ("%d ", f);
+    printf ("\n");
+  }
+  sem_post (&replmutex);
+}
+
+//==========================================
+// reference trace
+// every translated page reference is written as "pid page write", and
+// "pid -1 0" when a process ends and its frames are freed; replsim replays
+// the trace under each policy, including OPT, which needs the future
+//==========================================
+
+#define traceFN "replace.trace"
+FILE *ftrace = NULL;
+
+void trace_reference (int pid, int page, int write)
+{
+  if (ftrace != NULL) fprintf (ftrace, "%d %d %d\n", pid, page, write);
+}
+
+void trace_end (int pid)
+{
+  if (ftrace != NULL) fprintf (ftrace, "%d -1 0\n", pid);
+}
+
+void initialize_replacement ()
+{ int f;
+
+  sem_init (&replmutex, 0, 1);
+  lnext = (int *) malloc (numFrames * sizeof(int));
+  lprev = (int *) malloc (numFrames * sizeof(int));
+  lwhich = (char *) malloc (numFrames * sizeof(char));
+  for (f = 0; f < numFrames; f++) lwhich[f] = notListed;
+  Am.head = Am.tail = nullIndex;  Am.count = 0;
+  A1.head = A1.tail = nullIndex;  A1.count = 0;
+  A1inMax = (numFrames - OSpages) / 4;
+  if (A1inMax < 1) A1inMax = 1;
+  A1outSize = (numFrames - OSpages) / 2;
+  if (A1outSize < 1) A1outSize = 1;
+  A1outPid = (int *) malloc (A1outSize * sizeof(int));
+  A1outPage = (int *) malloc (A1outSize * sizeof(int));
+  A1outChain = (int *) malloc (A1outSize * sizeof(int));
+  A1outHashSize = 1;
+  while (A1outHashSize < A1outSize) A1outHashSize *= 2;
+  A1outHash = (int *) malloc (A1outHashSize * sizeof(int));
+  A1out_clear ();
+  if (replaceTrace)
+  { ftrace = fopen (traceFN, "w");
+    if (ftrace == NULL) printf ("Cannot open reference trace %s\n", traceFN);
+  }
+}
+
+void end_replacement ()
+{
+  if (ftrace != NULL) fclose (ftrace);
+  ftrace = NULL;
+}
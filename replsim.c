@@ -0,0 +1,259 @@
+//==========================================================
+// replsim.c
+// Offline comparison of page replacement policies.  It replays a page
+// reference trace recorded by replace.c (replaceTrace in config.sys) on
+// numFrames frames under each policy, including OPT, which needs to know
+// the future and so cannot run in the simulator, and reports the page
+// faults, the write-backs of dirty victims and an estimated run time of
+// one cycle per reference plus ioCost cycles per disk IO.
+// usage: replsim trace numFrames [periodAgeScan [ioCost]]
+//==========================================================
+#include <stdio.h>
+#include <stdlib.h>
+
+#define nullIndex -1
+#define never 0x7fffffff
+#define cleanScan 8   // as in replace.c
+
+typedef struct
+{ int pid, page, write;   // page -1: process pid ended
+  int key;      // the page, as one number
+  int next;     // the next reference to the same page, for OPT
+} Ref;
+
+typedef struct
+{ int key, pid, dirty, ref;
+  unsigned char age;
+  int used;     // when it was last referenced, for LRU
+  int loaded;   // when it was loaded, for the 2Q A1 FIFO
+  int inA1;     // 2Q: in A1 (else in Am)
+  int next;     // its next reference, for OPT
+} Frame;
+
+Ref *refs;
+int numRefs = 0;
+int numFrames, periodAgeScan = 8, ioCost = 100;
+Frame *frame;
+int *freeFrames;   // stack of free frames
+int *where;     // where[key]: the frame holding the page, or nullIndex
+int numKeys;    // distinct pid/page pairs, numbered through a hash
+int hand;       // clock hand
+int *A1out, A1outSize, A1outNext;   // 2Q: the pages last evicted from A1
+
+#define polClock 0
+#define clockDirtySteps 16   // as in paging.c
+#define polAging 1
+#define polLRU 2
+#define pol2Q 3
+#define polOPT 4
+char *polName[] = { "clock", "aging", "lru", "2q", "opt" };
+
+unsigned key_hash (int pid, int page, int hsize)
+{ return ((((unsigned) pid * 2654435761u) ^ (unsigned) page) % hsize); }
+
+void read_trace (char *fname)
+{ FILE *f;
+  int pid, page, write, size = 1024, maxPid = 0, k, key, h, hsize;
+  int *last, *endAt, *head, *chain, *keyPid, *keyPage;
+
+  f = fopen (fname, "r");
+  if (f == NULL) { printf ("Cannot open trace %s\n", fname); exit (1); }
+  refs = (Ref *) malloc (size * sizeof(Ref));
+  while (fscanf (f, "%d %d %d", &pid, &page, &write) == 3)
+  { if (numRefs == size)
+    { size = 2 * size;
+      refs = (Ref *) realloc (refs, size * sizeof(Ref));
+    }
+    refs[numRefs].pid = pid;
+    refs[numRefs].page = page;
+    refs[numRefs].write = write;
+    if (pid > maxPid) maxPid = pid;
+    numRefs++;
+  }
+  fclose (f);
+  // the pages are numbered 0..numKeys-1, pids and (sparse) page numbers
+  // can be large, their product does not fit
+  hsize = 1;
+  while (hsize < 2 * numRefs) hsize *= 2;
+  head = (int *) malloc (hsize * sizeof(int));
+  chain = (int *) malloc ((numRefs + 1) * sizeof(int));
+  keyPid = (int *) malloc ((numRefs + 1) * sizeof(int));
+  keyPage = (int *) malloc ((numRefs + 1) * sizeof(int));
+  for (h = 0; h < hsize; h++) head[h] = nullIndex;
+  numKeys = 0;
+  for (k = 0; k < numRefs; k++)
+  { if (refs[k].page < 0) continue;
+    h = key_hash (refs[k].pid, refs[k].page, hsize);
+    for (key = head[h]; key != nullIndex; key = chain[key])
+      if (keyPid[key] == refs[k].pid && keyPage[key] == refs[k].page) break;
+    if (key == nullIndex)
+    { key = numKeys++;
+      keyPid[key] = refs[k].pid;  keyPage[key] = refs[k].page;
+      chain[key] = head[h];  head[h] = key;
+    }
+    refs[k].key = key;
+  }
+  free (head);  free (chain);  free (keyPid);  free (keyPage);
+  // next use of each page, a process end is a use of none of its pages:
+  // endAt[pid] is the first end of pid after the reference (its pid may be
+  // reused), a use after that is not a use of the same page
+  last = (int *) malloc ((numKeys + 1) * sizeof(int));
+  endAt = (int *) malloc ((maxPid + 1) * sizeof(int));
+  for (k = 0; k < numKeys; k++) last[k] = never;
+  for (k = 0; k <= maxPid; k++) endAt[k] = never;
+  for (k = numRefs-1; k >= 0; k--)
+    if (refs[k].page >= 0)
+    { refs[k].next = (last[refs[k].key] < endAt[refs[k].pid]) ?
+                     last[refs[k].key] : never;
+      last[refs[k].key] = k;
+    }
+    else endAt[refs[k].pid] = k;
+  free (last);
+  free (endAt);
+}
+
+// the frame the policy gives up, a clean one when it can
+int select_victim (int policy, int now)
+{ int f, best = nullIndex, step, first = nullIndex, seen, count;
+  int a1count = 0, inA1 = 0, bestStep = 0;
+
+  switch (policy)
+  { case polClock:   // as select_clock_frame
+      for (step = 0; step < 2*numFrames; step++)
+      { f = hand;  hand = (hand + 1) % numFrames;
+        if (f == first) break;
+        if (best != nullIndex && step - bestStep >= clockDirtySteps) break;
+        if (frame[f].ref) { frame[f].ref = 0; continue; }
+        if (first == nullIndex) first = f;
+        if (!frame[f].dirty) return (f);
+        if (best == nullIndex) { best = f; bestStep = step; }
+      }
+      return (best);
+    case polAging:   // as select_aged_frame
+      for (f = 0; f < numFrames; f++)
+        if (best == nullIndex || frame[f].age < frame[best].age ||
+            (frame[f].age == frame[best].age && frame[best].dirty &&
+             !frame[f].dirty))
+          best = f;
+      return (best);
+    case pol2Q:   // the oldest in A1 when A1 is too long, else as LRU
+      for (f = 0; f < numFrames; f++) if (frame[f].inA1) a1count++;
+      inA1 = (a1count > numFrames / 4 || a1count == numFrames);
+      // fall through
+    case polLRU:   // the first clean frame among the cleanScan least recent
+      for (count = 0; count < cleanScan; count++)
+      { seen = nullIndex;
+        for (f = 0; f < numFrames; f++)
+        { if (policy == pol2Q && frame[f].inA1 != inA1) continue;
+          if (frame[f].used < 0) continue;   // looked at already
+          if (seen == nullIndex ||
+              (inA1 ? frame[f].loaded < frame[seen].loaded
+                    : frame[f].used < frame[seen].used))
+            seen = f;
+        }
+        if (seen == nullIndex) break;
+        if (best == nullIndex) best = seen;
+        frame[seen].used = -1 - frame[seen].used;   // mark, undone below
+        if (!frame[seen].dirty) { best = seen; break; }
+      }
+      for (f = 0; f < numFrames; f++)
+        if (frame[f].used < 0) frame[f].used = -1 - frame[f].used;
+      if (best == nullIndex) return (select_victim (polLRU, now));
+      if (policy == pol2Q && frame[best].inA1)
+      { A1out[A1outNext] = frame[best].key;
+        A1outNext = (A1outNext + 1) % A1outSize;
+      }
+      return (best);
+    case polOPT:   // the page used furthest in the future, clean on ties
+      for (f = 0; f < numFrames; f++)
+        if (best == nullIndex || frame[f].next > frame[best].next ||
+            (frame[f].next == frame[best].next && frame[best].dirty &&
+             !frame[f].dirty))
+          best = f;
+      return (best);
+  }
+  return (nullIndex);
+}
+
+int in_A1out (int key)
+{ int k;
+
+  for (k = 0; k < A1outSize; k++)
+    if (A1out[k] == key) { A1out[k] = nullIndex; return (1); }
+  return (0);
+}
+
+void simulate (int policy)
+{ int k, f, numFree = 0, faults = 0, writes = 0;
+  Ref *r;
+
+  for (k = 0; k < numKeys; k++) where[k] = nullIndex;
+  for (f = numFrames-1; f >= 0; f--)
+  { frame[f].key = nullIndex;
+    freeFrames[numFree++] = f;
+  }
+  for (k = 0; k < A1outSize; k++) A1out[k] = nullIndex;
+  hand = 0;  A1outNext = 0;
+  for (k = 0; k < numRefs; k++)
+  { r = &refs[k];
+    if (k % periodAgeScan == 0)   // the age scan, by reference count
+      for (f = 0; f < numFrames; f++) frame[f].age = frame[f].age >> 1;
+    if (r->page < 0)   // the process ended, its frames are free
+    { for (f = 0; f < numFrames; f++)
+        if (frame[f].key != nullIndex && frame[f].pid == r->pid)
+        { where[frame[f].key] = nullIndex;
+          frame[f].key = nullIndex;
+          freeFrames[numFree++] = f;
+        }
+      continue;
+    }
+    f = where[r->key];
+    if (f == nullIndex)
+    { faults++;
+      if (numFree > 0) f = freeFrames[--numFree];
+      else
+      { f = select_victim (policy, k);
+        if (frame[f].dirty) writes++;
+        where[frame[f].key] = nullIndex;
+      }
+      frame[f].key = r->key;
+      frame[f].pid = r->pid;
+      frame[f].dirty = 0;
+      frame[f].age = 0;
+      frame[f].loaded = k;
+      frame[f].inA1 = (policy == pol2Q && !in_A1out (r->key));
+      where[r->key] = f;
+    }
+    frame[f].ref = 1;
+    frame[f].age = frame[f].age | 0x80;
+    frame[f].used = k;
+    frame[f].next = r->next;
+    if (r->write) frame[f].dirty = 1;
+  }
+  printf ("%-6s %10d %12d %16ld\n", polName[policy], faults, writes,
+          (long) numRefs + (long) (faults + writes) * ioCost);
+}
+
+void main (int argc, char *argv[])
+{ int policy;
+
+  if (argc < 3)
+  { printf ("usage: replsim trace numFrames [periodAgeScan [ioCost]]\n");
+    exit (1);
+  }
+  numFrames = atoi (argv[2]);
+  if (argc > 3) periodAgeScan = atoi (argv[3]);
+  if (argc > 4) ioCost = atoi (argv[4]);
+  if (numFrames < 1 || periodAgeScan < 1)
+  { printf ("numFrames and periodAgeScan have to be positive\n"); exit (1); }
+  read_trace (argv[1]);
+  frame = (Frame *) malloc (numFrames * sizeof(Frame));
+  freeFrames = (int *) malloc (numFrames * sizeof(int));
+  where = (int *) malloc ((numKeys + 1) * sizeof(int));
+  A1outSize = (numFrames / 2 > 0) ? numFrames / 2 : 1;
+  A1out = (int *) malloc (A1outSize * sizeof(int));
+  printf ("%d references, %d frames, age scan every %d, IO cost %d\n",
+          numRefs, numFrames, periodAgeScan, ioCost);
+  printf ("policy     faults  write-backs  estimated cycles\n");
+  for (policy = polClock; policy <= polOPT; policy++) simulate (policy);
+}
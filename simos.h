@@ -24,7 +24,12 @@ int systemActive;
        // every child thread should test this for termination checking
 
 int maxProcess;    // max number of processes has to < maxProcess
+                   // pids are recycled, so this bounds the #live processes
+                   // it can be large (100k), PCB and swap are sparse
 int cpuQuantum;    // time quantum, defined in # instruction-cycles
+int minQuantum, maxQuantum;
+       // bounds of the adaptive per-process quantum, cpuQuantum is the
+       // initial quantum of each process, minQuantum=maxQuantum disables it
 int idleQuantum;   // time quantum for the idle process
 
 //memory
@@ -44,6 +49,54 @@ int periodAgeScan; // the period for scanning and shifting the age vectors
 int termPrintTime;   // simulated time (sleep) for terminal to output a string
 int diskRWtime;   // simulated time (sleep) for disk IO (a page)
 
+// medium-term scheduler: every mtsWindow cycles the system-wide #page
+// faults is checked, above mtsHighPF a whole process is swapped out,
+// below mtsLowPF a suspended process is brought back, mtsWindow=0 disables
+int mtsWindow, mtsHighPF, mtsLowPF;
+
+// loader.c keeps parsed program images, at most imageCacheKB KB, 0: off
+int imageCacheKB;
+
+// submit.c loads submitted programs on numLoaders threads, 0: synchronous
+int numLoaders;
+
+// pages a process faults on (or references, when prepaged) in its first
+// profileWindow cycles are saved in "<program>.prof" and prepaged on later
+// submissions, 0: no profiles
+int profileWindow;
+
+// the age scan ages at most ageScanChunk frames per interrupt, spread over
+// each periodAgeScan (over longer if one chunk a cycle is not enough),
+// 0: all frames in one interrupt
+int ageScanChunk;
+
+// a page fault in a sequential run reads up to readAheadMax following pages
+// in the same disk IO, the window adapts per process, 0: no readahead
+int readAheadMax;
+
+// page-fault-frequency frame allocation, see paging.c, 0: off
+// a process faulting within pffThreshold of its cycles of its previous
+// fault gets a larger frame allowance, otherwise a smaller one (>= pffMinFrames)
+int pffThreshold, pffMinFrames;
+
+// page replacement policy (see paging.c), replaceTrace 1: record the page
+// references in replace.trace for the offline comparison (replsim)
+#define replClock 0
+#define replAging 1
+#define replLRU 2
+#define repl2Q 3
+#define numPolicies 4
+int replacePolicy, replaceTrace;
+
+// the page-out daemon keeps freeLowWater..freeHighWater frames free, 0: off
+int freeLowWater, freeHighWater;
+
+// size of the compressed swap pool in front of swap.disk (zswap.c), 0: off
+int zswapKB;
+
+// same-page merging hashes mergeScanFrames frames per age interrupt, 0: off
+int mergeScanFrames;
+
 //=============== memory.c (NOW paging.c) related definitions ====================
 
 // memory data type defintion, could be int or float
@@ -59,10 +112,21 @@ typedef float mdType;
 #define nullPage -1   // page does not exist yet
 #define diskPage -2   // page is on disk swap space
 #define pendingPage -3  // page is pending till it is actually swapped
+#define zeroPage -4   // page is all zeros, filled in memory on first touch
 // have to ensure: #memory-frames < address-space/2, (pageSize >= 2)
 //    becuase we use negative values with the frame number
 // nullPage & diskPage are used in process page table 
 
+// two-level page table: a directory of leaves of 2^ptLeafShift entries
+// (paging.c), a leaf is only allocated once one of its pages gets an
+// entry, the entries of an absent leaf are nullPage
+typedef struct
+{ int **dir;       // dir[page >> ptLeafShift], NULL if absent
+  int numLeaves;   // #leaves allocated
+  int lastDir;     // the leaf of the last page the cpu translated
+  int *lastLeaf;
+} PageTable;
+
 typedef union     // type definition for memory (its content)
 { mdType mData;
   int mInstr;
@@ -92,22 +156,71 @@ void dump_memory ();
 int allocate_memory (int pid, int msize, int numinstr);
 int free_memory (int pid);  // only called by process.c 
 int free_process_memory (int pid);
+int swapout_process_memory (int pid, int **pages);
+       // called by process.c when the process is suspended
 void memory_agescan ();  // called by cpu.c after age scan interrupt
 
 // additional functions used by other .c files
 // by loader.c and swap.c
 void init_process_pagetable (int pid);
+void free_process_pagetable (int pid);   // by process.c
+int next_pagetable_page (int pid, int page);
 void update_process_pagetable (int pid, int page, int frame);
+int get_pagetable_entry (int pid, int page);
 void update_frame_info (int findex, int pid, int page);
 void direct_put_instruction (int findex, int offset, int instr);
 void direct_put_data (int findex, int offset, mdType data);
 int get_free_frame ();
 int count_free_frames();
 int load_page_to_memory(int pid, int page, unsigned *buf, int finishact);
+// text pages shared by processes running the same program image
+void attach_text_share (int pid, char *key, int numTextPages);
+void detach_text_share (int pid);
+void register_text_page (int pid, int page, int frame);
+int map_shared_text_page (int pid, int page);
+int share_text_page (int pid, int page);   // the same, taking memmutex
+void mark_prepaged (int pid, int page);   // profiled on first reference
+void leave_shared_frame (int findex, int pid, int page);
+// copy-on-write fork
+void fork_process_memory (int ppid, int pid);   // by process.c
+void cow_copy_page (int pid, int page);   // by swap.c
+void set_zero_page (int pid, int page);   // by loader.c, demand-zero page
+void zero_fill_page (int pid, int page);  // by swap.c
+// zero-copy swap IO, by swap.c
+unsigned *frame_memory (int findex);
+int reserve_frame (int pid);
+void install_frame (int frame, int pid, int page, int zfill);
+void install_readahead_frame (int frame, int pid, int page);
+void release_frame (int frame);
+int page_out_pending (int findex, int pid, int page);
+void end_page_out (int findex);
+void dump_replacement_info ();
+void start_pageout_daemon ();   // by system.c
+void end_pageout_daemon ();
+// by replace.c
+int frame_evictable (int findex);
+int frame_dirty (int findex);
+int frame_pid (int findex);
+int frame_page (int findex);
 
 // by cpu.c
 void page_fault_handler ();
 
+//=============== replace.c related definitions ====================
+
+// by paging.c
+void initialize_replacement ();
+void replace_loaded (int findex, int pid, int page);
+void replace_referenced (int findex);
+void replace_freed (int findex);
+int select_listed_frame ();
+void trace_reference (int pid, int page, int write);
+void trace_end (int pid);
+void dump_replacement_lists ();
+// by admin.c and system.c
+void set_replacement_policy (int policy);
+void end_replacement ();
+
 
 //================= cpu.c related definitions ======================
 
@@ -121,7 +234,7 @@ struct
   int IRopcode;
   int IRoperand;
   int MDbase;
-  int *PTptr;
+  PageTable *PTptr;
   int exeStatus;
   unsigned interruptV;
   int numCycles;  // this is a global register, not for each process
@@ -153,6 +266,7 @@ void initialize_cpu ();  // called by system.c
 void cpu_execution ();   // called by process.c
 void dump_registers ();
 void set_interrupt (unsigned bit);  
+void clear_interrupt (unsigned bit);
      // called by clock.c for tqInterrup, memory.c  for ageInterrupt
      // called by clock.c for endWaitInterrupt (sleep)
      // called by term.c for endWaitInterrupt (termio)
@@ -165,11 +279,37 @@ typedef struct
 { int Pid;
   int PC;
   mdType AC;
-  int *PTptr;
+  PageTable *PTptr;
   int MDbase;
   int exeStatus;
   int timeUsed;
   int numPF;
+  // accounting info, all times are in instruction cycles (CPU.numCycles)
+  int submitTime;    // when the process was submitted
+  int dispatchTime;  // when the process got the cpu for the first time
+  int endTime;       // when the process completed (or had an error)
+  int readyTime;     // total time waiting in the ready queue
+  int sleepTime;     // total time in eWait for OPsleep
+  int pfaultTime;    // total time in ePFault (including the initial load)
+  int termTime;      // total time in eWait for the terminal queue
+  int numCS;         // number of context switches into the cpu
+  int stateTime;     // when the process entered its current waiting state
+  int waitKind;      // which of the above waiting states it is in
+  int quantum;       // adaptive time quantum of this process
+  int suspend;       // medium-term scheduler state, see process.c
+  int windowPF;      // #page faults in the current medium-term window
+  int windowId;      // the window windowPF belongs to
+  int *swapSet;      // pages resident when suspended, to be swapped back
+  int numSwapSet;
+  int textGroup;     // shared text group of its program, see paging.c
+  char *progName;    // the program file, for its prepaging profile
+  int *profile;      // the pages of its early working set, as noted
+  int numProfile, profileSize;
+  int raNext;        // the fault that continues a sequential run, paging.c
+  int raWindow;      // #pages read ahead on the next sequential fault
+  int resident;      // #frames owned, when page-fault-frequency is on
+  int allowance;     // #frames it should own, by its page-fault frequency
+  int pffLast;       // its cpu time at its previous page fault
 } typePCB;
 
 typePCB **PCB;
@@ -189,10 +329,15 @@ void initialize_process_manager ();
 
 // define process manipulation functions
 
+#define dumpPageProcess 16   // #processes shown by one paginated dump
+
 void dump_PCB (int pid); 
-void dump_PCB_list ();
-void dump_PCB_memory ();
+void dump_PCB_list (int from);
+void hold_PCBs ();      // PCBs are not created or freed till release_PCBs,
+void release_PCBs ();   // taken by the dumps that walk them
+void dump_PCB_memory (int from);
 void dump_ready_queue ();
+void dump_suspended_list ();
 
 void insert_endWait_process (int pid); 
      // called by clock.c (sleep), term.c (output), memory.c (page fault)
@@ -203,7 +348,13 @@ void dump_endWait_list ();
 
 void initialize_process ();  // called by system.c
 int submit_process (char* fname);  // called by submit.c
-void execute_process ();  // called by admin.c
+int fork_process (int ppid);  // called by cpu.c for OPfork
+void execute_process ();  // called by the cpu thread
+void start_cpu ();  // called by system.c, start the cpu thread
+void end_cpu ();
+void cpu_step (int rounds);  // called by admin.c to control the cpu thread
+void cpu_run ();
+void cpu_pause ();
 void insert_ready_process(); //called by loader when loading fresh programs, and probably 
 
 
@@ -216,24 +367,53 @@ void insert_ready_process(); //called by loader when loading fresh programs, and
 #define Both    6   // 6: both 2 and 4 (not used)
 #define actRead 0   // flags for act (action), read or write, with(out) signal
 #define actWrite 1
+#define actWriteImage 2   // write npages consecutive pages with one write
+#define actInstall 3   // put buf in memory, it is already in (or bound for) swap
+#define actSignal 4   // no disk action, only the finishact, after earlier requests
+#define actZeroFill 5   // no disk action, put a zeroed page in memory
+#define actWriteFrame 6   // write a page straight from its pinned frame
+#define actCopySwap 7   // copy the listed swap pages of a forked child's parent
+#define actCopyPage 8   // private copy of a copy-on-write page, no disk action
+#define actDropPool 9   // drop an ended process's pages from the zswap pool
 
 void insert_swapQ (int pid, int page, unsigned *buf, int act, int finishact);
+void insert_swapQ_pages (int pid, int page, unsigned *buf, int npages,
+                         int act, int finishact);
+void insert_swapQ_frame (int pid, int page, int frame);
+void insert_swapQ_copy (int pid, int from, unsigned *pages, int npages);
+int read_swap_page (int pid, int page, unsigned *buf);
+int write_swap_page (int pid, int page, unsigned *buf);
+int write_swap_pages (int pid, int page, unsigned *buf, int npages);
 void dump_swapQ ();
 int dump_process_swap_page (int pid, int page);
 void dump_process_swap (int pid);
-void dump_swap ();
+void dump_swap (int from);
 void start_swap_manager ();
 void end_swap_manager ();
 
+//=============== zswap.c related definitions ====================
+
+// by swap.c
+void initialize_zswap ();
+int zswap_store (int pid, int page, unsigned *buf);
+int zswap_load (int pid, int page, unsigned *buf);
+int zswap_has (int pid, int page);
+void zswap_invalidate (int pid, int page, int npages);
+// by swap.c when a process has ended, by admin.c
+void zswap_drop_process (int pid);
+void dump_zswap ();
+
 //=============== clock.c related definitions ====================
 
 #define oneTimeTimer 0
+#define ownedTimer -1   // one time timer, the owner always calls deactivate_timer
 
 // define the action codes for timer
 #define actTQinterrupt 1
 #define actAgeInterrupt 2
 #define actReadyInterrupt 3
 #define actNull 0
+#define actFired -1   // an ownedTimer has expired, waiting for deactivate_timer
 
 // define the clock function
 void advance_clock ();  
@@ -247,6 +427,7 @@ genericPtr add_timer (int time, int pid, int action, int recurperiod);
            // by memory.c for age scan, by cpu.c for sleep timer
 void deactivate_timer (genericPtr castedevent);
      // called by process.c when process ends due to error or completed
+     // an ownedTimer is freed here, whether it has expired or not
 
 
 //=============== term.c related definitions ====================
@@ -270,7 +451,18 @@ void process_admin_command ();
 void start_client_submission ();
 void end_client_submission ();
 void one_submission ();
+void start_loaders ();
+void end_loaders ();
+void dump_submission_queue ();
+void initialize_loader ();
 int load_process (int pid, char *fname);
+void note_profile_page (int pid, int page);
+     // by paging.c on a fault or the first reference of a prepaged page
+void write_profile (int pid);   // by process.c when a process ends
+
+int convert_program (char *src, char *dst);
+       // convert a text program to a binary image that is loaded with mmap
+void dump_image_cache ();
 void load_idle_process ();
 void start_swap_manager ();
 
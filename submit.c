@@ -1,5 +1,8 @@
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "simos.h"
 
 //===============================================================
@@ -13,13 +16,16 @@
 // sent back to the client and client prints on its terminal.
 //===============================================================
 
+void insert_submission (char *fname);
+
 void one_submission ()
 { char fname[100];
 
   printf ("Submission file: ");
   scanf ("%s", &fname);
   if (Debug) printf ("File name: %s has been submitted\n", fname);
-  submit_process (fname);
+  if (numLoaders > 0) insert_submission (fname);
+  else submit_process (fname);
 }
 
 void *process_submissions ()
@@ -49,3 +55,109 @@ void end_client_submission ()
 }
 
 
+//===============================================================
+// Asynchronous submission
+// with numLoaders > 0, one_submission only queues the program name and
+// returns; numLoaders loader threads take names from the submission
+// queue and load them in parallel (parse the program, build its pages,
+// queue the swap I/O).  The swap manager readies a process only after
+// its initial pages are in, so it reaches the ready queue fully staged.
+// numLoaders = 0 loads on the admin thread as before.
+//===============================================================
+
+typedef struct SubmitNodeStruct
+{ char *fname;   // NULL tells a loader thread to quit
+  struct SubmitNodeStruct *next;
+} SubmitNode;
+
+SubmitNode *submitHead = NULL, *submitTail = NULL;
+int numQueued = 0, numLoading = 0, numLoaded = 0;
+sem_t submutex, subready;
+pthread_t *loaderThreads;
+
+void enqueue_submission (char *fname)
+{ SubmitNode *node;
+
+  node = (SubmitNode *) malloc (sizeof(SubmitNode));
+  node->fname = fname;
+  node->next = NULL;
+  sem_wait (&submutex);
+  if (submitTail == NULL) submitHead = node;
+  else submitTail->next = node;
+  submitTail = node;
+  if (fname != NULL) numQueued++;
+  sem_post (&submutex);
+  sem_post (&subready);
+}
+
+void insert_submission (char *fname)
+{ enqueue_submission (strdup (fname));
+}
+
+char *get_submission ()
+{ SubmitNode *node;
+  char *fname;
+
+  sem_wait (&subready);
+  sem_wait (&submutex);
+  node = submitHead;
+  submitHead = node->next;
+  if (submitHead == NULL) submitTail = NULL;
+  fname = node->fname;
+  if (fname != NULL) { numQueued--; numLoading++; }
+  sem_post (&submutex);
+  free (node);
+  return (fname);
+}
+
+void *loader_thread (void *arg)
+{ char *fname;
+
+  while ((fname = get_submission ()) != NULL)
+  { submit_process (fname);
+    free (fname);
+    sem_wait (&submutex);
+    numLoading--; numLoaded++;
+    sem_post (&submutex);
+  }
+  return (NULL);
+}
+
+void dump_submission_queue ()
+{ SubmitNode *node;
+
+  if (numLoaders == 0) return;
+  sem_wait (&submutex);
+  printf ("******************** Submission Queue Dump\n");
+  printf ("%d queued, %d loading, %d loaded by %d loaders\n",
+          numQueued, numLoading, numLoaded, numLoaders);
+  for (node = submitHead; node != NULL; node = node->next)
+    if (node->fname != NULL) printf ("%s, ", node->fname);
+  printf ("\n");
+  sem_post (&submutex);
+}
+
+void start_loaders ()
+{ int i, ret;
+
+  if (numLoaders == 0) return;
+  sem_init (&submutex, 0, 1);
+  sem_init (&subready, 0, 0);
+  loaderThreads = (pthread_t *) malloc (numLoaders * sizeof(pthread_t));
+  for (i = 0; i < numLoaders; i++)
+  { ret = pthread_create (&loaderThreads[i], NULL, loader_thread, NULL);
+    if (ret < 0) printf ("Loader thread creation problem\n");
+  }
+  printf ("%d loader threads have been created successsfully\n", numLoaders);
+}
+
+// the submissions queued so far are loaded before the loaders quit
+void end_loaders ()
+{ int i;
+
+  if (numLoaders == 0) return;
+  for (i = 0; i < numLoaders; i++) enqueue_submission (NULL);
+  for (i = 0; i < numLoaders; i++) pthread_join (loaderThreads[i], NULL);
+  free (loaderThreads);
+  printf ("Loader threads have finished, %d programs loaded\n", numLoaded);
+}
@@ -9,8 +9,10 @@
 #define _BRD_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <semaphore.h>
 #include <pthread.h>
@@ -26,7 +28,7 @@
 #define swapFname "swap.disk"
 #define itemPerLine 8
 int diskfd;
-int swapspaceSize;
+off_t swapspaceSize;
 int PswapSize;
 int pagedataSize;
 
@@ -44,43 +46,92 @@ pthread_t swapQThread;
 // first 2 processes: OS=0, idle=1, have no swap space
 // OS frequently (like Linux) runs on physical memory address (fixed locations)
 // virtual memory is too expensive and unnecessary for OS => no swap needed
+// the swap file is sparse, disk blocks are only allocated when a page is
+// written, so a large maxProcess does not cost disk space up front
 
-int read_swap_page (int pid, int page, unsigned *buf)
+off_t swap_location (int pid, int page)
+{ return ((off_t)(pid-2) * PswapSize + (off_t)page * pagedataSize); }
+
+// read npages consecutive pages of pid, starting at page, as one disk IO
+int read_swap_pages (int pid, int page, unsigned *buf, int npages)
 { 
   // reference the previous code for this part
   // but previous code was not fully completed
-  if (pid < 2 || pid > maxProcess) 
+  if (pid < 2 || pid >= maxProcess) 
   { printf ("Error: Incorrect pid for disk read: %d\n", pid); 
     return (-1);
   }
-  int location = (pid-2) * PswapSize + page*pagedataSize;
-  int ret = lseek (diskfd, location, SEEK_SET);
-  if (ret < 0) perror ("Error lseek in read: \n");
-
-  int retsize = read (diskfd, buf, pagedataSize);
-  if (retsize != pagedataSize) 
-  { printf ("Error: Disk read returned incorrect size: %d\n", retsize); 
-    exit(-1);
+  // no disk IO if all the pages are in the compressed pool, which has
+  // the newer copy of a page that is in both
+  int k, pooled = 0;
+  for (k = 0; k < npages; k++) pooled += zswap_has (pid, page+k);
+  if (pooled < npages)
+  { off_t ret = lseek (diskfd, swap_location (pid, page), SEEK_SET);
+    if (ret < 0) perror ("Error lseek in read: \n");
+
+    int retsize = read (diskfd, buf, npages*pagedataSize);
+    if (retsize != npages*pagedataSize) 
+    { printf ("Error: Disk read returned incorrect size: %d\n", retsize); 
+      exit(-1);
+    }
+    usleep (diskRWtime);
   }
-  usleep (diskRWtime);
+  for (k = 0; k < npages; k++) zswap_load (pid, page+k, buf + k*pageSize);
 
   //we should return something better than just 0
   return 0;
 }
 
-int write_swap_page (int pid, int page, unsigned *buf)
+int read_swap_page (int pid, int page, unsigned *buf)
+{ return (read_swap_pages (pid, page, buf, 1));
+}
+
+// read npages consecutive pages of pid, starting at page, straight into
+// their frames (not consecutive in memory), as one disk IO
+int read_swap_frames (int pid, int page, int *frames, int npages)
+{ struct iovec *iov;
+  int k, pooled = 0;
+
+  if (pid < 2 || pid >= maxProcess) 
+  { printf ("Error: Incorrect pid for disk read: %d\n", pid); 
+    return (-1);
+  }
+  for (k = 0; k < npages; k++) pooled += zswap_has (pid, page+k);
+  if (pooled < npages)
+  { off_t ret = lseek (diskfd, swap_location (pid, page), SEEK_SET);
+    if (ret < 0) perror ("Error lseek in read: \n");
+
+    iov = (struct iovec *) malloc (npages * sizeof(struct iovec));
+    for (k = 0; k < npages; k++)
+    { iov[k].iov_base = frame_memory (frames[k]);
+      iov[k].iov_len = pagedataSize;
+    }
+    int retsize = readv (diskfd, iov, npages);
+    free (iov);
+    if (retsize != npages*pagedataSize) 
+    { printf ("Error: Disk read returned incorrect size: %d\n", retsize); 
+      exit(-1);
+    }
+    usleep (diskRWtime);
+  }
+  for (k = 0; k < npages; k++)
+    zswap_load (pid, page+k, frame_memory (frames[k]));
+  return 0;
+}
+
+// write npages consecutive pages of pid, starting at page, as one disk IO
+int write_swap_pages (int pid, int page, unsigned *buf, int npages)
 { 
   // reference the previous code for this part
   // but previous code was not fully completed
-  if (pid < 2 || pid > maxProcess) 
+  if (pid < 2 || pid >= maxProcess) 
   { printf ("Error: Incorrect pid for disk write: %d\n", pid); 
     return (-1);
   }
-  int location = (pid-2) * PswapSize + page*pagedataSize;
-  int ret = lseek (diskfd, location, SEEK_SET);
+  off_t ret = lseek (diskfd, swap_location (pid, page), SEEK_SET);
   if (ret < 0) perror ("Error lseek in write: \n");
-  int retsize = write (diskfd, buf, pagedataSize);
-  if (retsize != pagedataSize) 
+  int retsize = write (diskfd, buf, npages*pagedataSize);
+  if (retsize != npages*pagedataSize) 
     { printf ("Error: Disk write returned incorrect size: %d\n", retsize); 
       exit(-1);
     }
@@ -90,16 +141,21 @@ int write_swap_page (int pid, int page, unsigned *buf)
   return 0;
 }
 
+// a page written back goes to the compressed pool, if there is one
+int write_swap_page (int pid, int page, unsigned *buf)
+{ if (zswap_store (pid, page, buf)) return (0);
+  return (write_swap_pages (pid, page, buf, 1));
+}
+
 int dump_process_swap_page (int pid, int page)
 { 
   // reference the previous code for this part
   // but previous code was not fully completed
-  if (pid < 2 || pid > maxProcess) 
+  if (pid < 2 || pid >= maxProcess) 
   { printf ("Error: Incorrect pid for disk dump: %d\n", pid); 
     return (-1);
   }
-  int location = (pid-2) * PswapSize + page*pagedataSize;
-  int ret = lseek (diskfd, location, SEEK_SET);
+  off_t ret = lseek (diskfd, swap_location (pid, page), SEEK_SET);
   //printf ("loc %d %d %d, size %d\n", pid, page, location, pagedataSize);
   if (ret < 0) perror ("Error lseek in dump: \n");
   unsigned *buf = (unsigned *) malloc(pagedataSize);
@@ -109,6 +165,8 @@ int dump_process_swap_page (int pid, int page)
     exit(-1);
   }
   printf ("Content of process %d page %d:\n", pid, page);
+  if (zswap_has (pid, page))
+    printf ("(a newer copy is in the compressed pool)\n");
   int k;
   int loc = (pid - 2) * maxPpages * pageSize + page * pageSize;
   for (k=0; k<pageSize; k++){
@@ -119,41 +177,43 @@ int dump_process_swap_page (int pid, int page)
   return 0;
 }
 
+// only the pages in the process's page table leaves, the others are unused
 void dump_process_swap (int pid)
 { int j;
 
   printf ("****** Dump swap pages for process %d\n", pid);
-  for (j=0; j<maxPpages; j++) dump_process_swap_page (pid, j);
+  for (j=next_pagetable_page(pid, 0); j<maxPpages;
+       j=next_pagetable_page(pid, j+1))
+    dump_process_swap_page (pid, j);
 }
 
-void dump_swap() {
-	int pid;
+// paginated like dump_PCB_list, at most dumpPageProcess processes
+void dump_swap(int from) {
+	int pid, count = 0;
 	if (currentPid == 2) {
 		printf("No processes loaded in swap.disk");
 	}
-	for (pid = idlePid + 1; pid < currentPid; pid++)
-		if (PCB[pid] != NULL) dump_process_swap(pid);
+	if (from < idlePid + 1) from = idlePid + 1;
+	hold_PCBs();
+	for (pid = from; pid < currentPid && count < dumpPageProcess; pid++)
+		if (PCB[pid] != NULL) { dump_process_swap(pid); count++; }
+	release_PCBs();
+	if (pid < currentPid) printf("More processes, continue from pid %d\n", pid);
 }
 // open the file with the swap space size, initialize content to 0
+// the file is truncated and then extended, which gives a sparse file that
+// reads as 0, instead of writing maxProcess*maxPpages zero pages
 void initialize_swap_space ()
-{ int ret, i, j, k;
-  unsigned buf[pageSize];
+{ int ret;
 
-  swapspaceSize = maxProcess*maxPpages*pageSize*dataSize;
+  swapspaceSize = (off_t)maxProcess*maxPpages*pageSize*dataSize;
   PswapSize = maxPpages*pageSize*dataSize;
   pagedataSize = pageSize*dataSize;
 
-  diskfd = open (swapFname, O_RDWR | O_CREAT, 0600);
+  diskfd = open (swapFname, O_RDWR | O_CREAT | O_TRUNC, 0600);
   if (diskfd < 0) { perror ("Error open: "); exit (-1); }
-  ret = lseek (diskfd, swapspaceSize, SEEK_SET); 
-  if (ret < 0) { perror ("Error lseek in open: "); exit (-1); }
-  for (i=2; i<maxProcess; i++)
-    for (j=0; j<maxPpages; j++)
-    { for (k=0; k<pageSize; k++) buf[k]=0;
-      write_swap_page (i, j, buf);
-    }
-    // last parameter is the origin, offset from the origin, which can be:
-    // SEEK_SET: 0, SEEK_CUR: from current position, SEEK_END: from eof
+  ret = ftruncate (diskfd, swapspaceSize); 
+  if (ret < 0) { perror ("Error ftruncate in open: "); exit (-1); }
 }
 
 
@@ -173,6 +233,9 @@ void initialize_swap_space ()
 
 typedef struct SwapQnodeStruct
 { int pid, page, act, finishact;
+  int npages;   // #pages in buf, for actWriteImage and readahead actRead
+  int frame;    // actWriteFrame: the pinned frame buf points into
+                // actCopySwap: the pid the pages are copied from
   unsigned *buf;
   struct SwapQnodeStruct *next;
 } SwapQnode;
@@ -180,13 +243,16 @@ typedef struct SwapQnodeStruct
 // pidout, pageout, outbuf: for the page to be swapped out
 // if there is no page to be swapped out (not dirty), then pidout = nullPid
 // inbuf and outbuf are the actual memory page content
+// actRead has no buf, the pages are read straight into frames, and
+// actWriteFrame writes straight from the frame, see zero-copy in paging.c
 
 SwapQnode *swapQhead = NULL;
 SwapQnode *swapQtail = NULL;
 
 void print_one_swapnode (SwapQnode *node)
-{ printf ("pid,page=(%d,%d), act,ready=(%d, %d), buf=%x\n", 
-           node->pid, node->page, node->act, node->finishact, node->buf);
+{ printf ("pid,page=(%d,%d), act,ready=(%d, %d), npages=%d, buf=%x\n", 
+           node->pid, node->page, node->act, node->finishact, node->npages,
+           node->buf);
 }
 
 void dump_swapQ ()
@@ -204,22 +270,63 @@ void dump_swapQ ()
   }
 }
 
+void insert_swapQ_node (int pid, int page, unsigned *buf, int npages,
+                        int frame, int act, int finishact);
+
 // act can be actRead or actWrite
 // finishact indicates what to do after read/write swap disk is done, it can be:
 // toReady (send pid back to ready queue), freeBuf: free buf, Both, Nothing
 void insert_swapQ (pid, page, buf, act, finishact)
 int pid, page, act, finishact;
 unsigned *buf;
+{ insert_swapQ_pages (pid, page, buf, 1, act, finishact);
+}
+
+// npages pages starting at page, buf holds all of them
+void insert_swapQ_pages (int pid, int page, unsigned *buf, int npages,
+                         int act, int finishact)
+{ insert_swapQ_node (pid, page, buf, npages, nullIndex, act, finishact);
+}
+
+// write back page of pid straight from frame, which is pinned till then
+void insert_swapQ_frame (int pid, int page, int frame)
+{ insert_swapQ_node (pid, page, frame_memory (frame), 1, frame,
+                     actWriteFrame, Nothing);
+}
+
+// a forked child gets copies of the swap pages of process from, the npages
+// page numbers in pages (ascending), the list is freed when done
+void insert_swapQ_copy (int pid, int from, unsigned *pages, int npages)
+{ insert_swapQ_node (pid, 0, pages, npages, from, actCopySwap, freeBuf);
+}
+
+// the swap copies go in runs of consecutive pages, a read and a write each
+void copy_swap_pages (int pid, int from, unsigned *pages, int npages)
+{ unsigned *buf;
+  int k, n;
+
+  buf = (unsigned *) malloc (npages * pagedataSize);
+  for (k = 0; k < npages; k += n)
+  { n = 1;
+    while (k+n < npages && pages[k+n] == pages[k] + n) n++;
+    read_swap_pages (from, pages[k], buf, n);
+    zswap_invalidate (pid, pages[k], n);
+    write_swap_pages (pid, pages[k], buf, n);
+  }
+  free (buf);
+}
+
+void insert_swapQ_node (int pid, int page, unsigned *buf, int npages,
+                        int frame, int act, int finishact)
 { sem_wait(&swapq_mutex);
   SwapQnode *node = (SwapQnode *) malloc(sizeof(SwapQnode));
   if(Debug)
     printf("-------------inserting into swapQ pid/page/act/finishact : %d/%d/%d/%d\n", pid, page, act, finishact);  
-  if(buf == NULL){
-    buf = malloc(sizeof(unsigned) * pagedataSize);
-  }
 
   node->pid = pid;
   node->page = page;
+  node->npages = npages;
+  node->frame = frame;
   node->act = act;
   node->finishact = finishact;
   node->buf = buf;
@@ -259,21 +366,94 @@ void *process_swapQ (void* dummy)
 		//prepare for the disk action
 		switch (node->act) {
 			case actRead: { 
-        //read from swap space
-        if(node->finishact == toReady){
-          add_timer(diskRWtime+1, node->pid, actReadyInterrupt, 0);
+        //read from swap space, the faulting page and the pages read ahead,
+        //straight into the frames reserved for them
+        //the process is readied below, only once the page is in memory
+        int k, n;
+        int *frames = (int *) malloc(node->npages * sizeof(int));
+        for(n = 0; n < node->npages; n++){
+          frames[n] = reserve_frame(node->pid);
+          if(frames[n] == nullIndex) break;
+        }
+        // pages left without a frame are not read ahead after all
+        for(k = (n > 0) ? n : 1; k < node->npages; k++)
+          if(PCB[node->pid] != NULL &&
+             get_pagetable_entry(node->pid, node->page+k) == pendingPage)
+            update_process_pagetable(node->pid, node->page+k, diskPage);
+        if(n == 0){
+          printf("ERROR: no frame for page %d of pid %d\n", node->page, node->pid);
+          if(PCB[node->pid] != NULL)   // it faults again when it runs
+            update_process_pagetable(node->pid, node->page, diskPage);
+          free(frames);
+          break;
         }
-        read_swap_page(node->pid, node->page, node->buf);
-        load_page_to_memory(node->pid,node->page, node->buf, node->finishact);
+        read_swap_frames(node->pid, node->page, frames, n);
+        // the cpu thread may have terminated the process in the mean time
+        // and a page read twice (a fault while it was pending) is in already
         //pcb pttbl will be set in paging instead.
+        if(PCB[node->pid] == NULL ||
+           get_pagetable_entry(node->pid, node->page) >= 0)
+          release_frame(frames[0]);
+        else install_frame(frames[0], node->pid, node->page, 0);
+        for(k = 1; k < n; k++){
+          if(PCB[node->pid] == NULL) release_frame(frames[k]);
+          else install_readahead_frame(frames[k], node->pid, node->page+k);
+        }
+        free(frames);
         }
         break;
 			case actWrite: {
 				//write to swap space
 				write_swap_page(node->pid, node->page, node->buf);
         //don't forget to tell pcb that the frame is now on disk space
-        update_process_pagetable(node->pid, node->page, diskPage);
+        //unless the process has terminated (its pid may be reused)
+        //or the page has been brought back in the mean time
+        if(PCB[node->pid] != NULL &&
+           get_pagetable_entry(node->pid, node->page) == pendingPage)
+          update_process_pagetable(node->pid, node->page, diskPage);
+        }
+        break;
+			case actWriteFrame:
+        //write straight from the pinned frame, then free it, unless the
+        //write has been done already to reuse the frame (steal_page_out)
+        if(page_out_pending(node->frame, node->pid, node->page)){
+          write_swap_page(node->pid, node->page, node->buf);
+          end_page_out(node->frame);
+        }
+        break;
+			case actWriteImage: {
+				//the whole image of a new process in one write
+				zswap_invalidate(node->pid, node->page, node->npages);
+				write_swap_pages(node->pid, node->page, node->buf, node->npages);
+        int k;
+        for (k = node->page; k < node->page + node->npages; k++)
+          if(PCB[node->pid] != NULL &&
+             get_pagetable_entry(node->pid, k) == pendingPage)
+            update_process_pagetable(node->pid, k, diskPage);
         }
+        break;
+			case actInstall: {
+        //the page comes from the loader, no disk read
+        if(PCB[node->pid] == NULL) free(node->buf);
+        else load_page_to_memory(node->pid,node->page, node->buf, node->finishact);
+        }
+        break;
+			case actZeroFill:
+        //first touch of a demand-zero page, no disk read
+        if(PCB[node->pid] != NULL) zero_fill_page(node->pid, node->page);
+        break;
+			case actCopySwap:
+        //a forked child's swap space, before any of its page faults
+        if(PCB[node->pid] != NULL)
+          copy_swap_pages(node->pid, node->frame, node->buf, node->npages);
+        break;
+			case actCopyPage:
+        //a write to a copy-on-write page, no disk action
+        if(PCB[node->pid] != NULL) cow_copy_page(node->pid, node->page);
+        break;
+			case actDropPool:
+        //after the requests queued before the process ended
+        zswap_drop_process(node->pid);
         break;
 			default:
 			  break;
@@ -285,7 +465,7 @@ void *process_swapQ (void* dummy)
 			case Nothing:
 				break;
 			case freeBuf:
-				if (node->act==actRead) {
+				if (node->act==actRead || node->act==actInstall) {
 					//should only occur for write not read
 					printf("ERROR: Attempt to free buffer during read\n");
 				}
@@ -294,10 +474,13 @@ void *process_swapQ (void* dummy)
 				}
 				break;
 			case toReady:
-        if(node->act == actWrite){
+        if(node->act == actWrite || node->act == actWriteImage ||
+           node->act == actWriteFrame){
           printf("ERROR: Cannot place a process to ReadyQ on actWrite\n");
-        } else {
-          // insert_ready_process(node->pid);
+        } else if(PCB[node->pid] != NULL){
+          // the page is in memory now, the process can run
+          insert_endWait_process(node->pid);
+          set_interrupt(endWaitInterrupt);
         }
 				break;
 			case Both:
@@ -321,6 +504,7 @@ void start_swap_manager ()
   sem_init(&disk_mutex, 0, 1);  //disk should be available at the start
 
   initialize_swap_space ();
+  initialize_zswap ();
 
   // create swap thread
   int ret = pthread_create(&swapQThread, NULL, process_swapQ, NULL);
@@ -15,7 +15,47 @@ void initialize_system ()
           &periodAgeScan, &termPrintTime, &diskRWtime, str);
   fscanf (fconfig, "%d %d %d %d %d %s\n", &Debug,
           &cpuDebug, &memDebug, &swapDebug, &clockDebug, str);
+  // the lines below are optional, an older config.sys keeps the defaults
+  minQuantum = cpuQuantum;  maxQuantum = cpuQuantum;
+  fscanf (fconfig, "%d %d %s\n", &minQuantum, &maxQuantum, str);
+  mtsWindow = 0;  mtsHighPF = 0;  mtsLowPF = 0;
+  fscanf (fconfig, "%d %d %d %s\n", &mtsWindow, &mtsHighPF, &mtsLowPF, str);
+  imageCacheKB = 0;
+  fscanf (fconfig, "%d %s\n", &imageCacheKB, str);
+  numLoaders = 0;
+  fscanf (fconfig, "%d %s\n", &numLoaders, str);
+  profileWindow = 0;
+  fscanf (fconfig, "%d %s\n", &profileWindow, str);
+  ageScanChunk = 0;
+  fscanf (fconfig, "%d %s\n", &ageScanChunk, str);
+  readAheadMax = 0;
+  fscanf (fconfig, "%d %s\n", &readAheadMax, str);
+  pffThreshold = 0;  pffMinFrames = 1;
+  fscanf (fconfig, "%d %d %s\n", &pffThreshold, &pffMinFrames, str);
+  replacePolicy = replClock;  replaceTrace = 0;
+  fscanf (fconfig, "%d %d %s\n", &replacePolicy, &replaceTrace, str);
+  freeLowWater = 0;  freeHighWater = 0;
+  fscanf (fconfig, "%d %d %s\n", &freeLowWater, &freeHighWater, str);
+  zswapKB = 0;
+  fscanf (fconfig, "%d %s\n", &zswapKB, str);
+  mergeScanFrames = 0;
+  fscanf (fconfig, "%d %s\n", &mergeScanFrames, str);
   fclose (fconfig);
+  if (minQuantum < 1) minQuantum = 1;
+  if (maxQuantum < minQuantum) maxQuantum = minQuantum;
+  if (numLoaders < 0) numLoaders = 0;
+  if (ageScanChunk < 0) ageScanChunk = 0;
+  if (readAheadMax < 0) readAheadMax = 0;
+  if (pffThreshold < 0) pffThreshold = 0;
+  if (pffMinFrames < 1) pffMinFrames = 1;
+  if (replacePolicy < 0 || replacePolicy >= numPolicies)
+    replacePolicy = replClock;
+  if (freeLowWater < 0) freeLowWater = 0;
+  if (freeLowWater > numFrames - OSpages) freeLowWater = numFrames - OSpages;
+  if (freeHighWater < freeLowWater) freeHighWater = freeLowWater;
+  if (freeHighWater > numFrames - OSpages) freeHighWater = numFrames - OSpages;
+  if (zswapKB < 0) zswapKB = 0;
+  if (mergeScanFrames < 0) mergeScanFrames = 0;
 
   // all processing has a while loop on systemActive
   // admin with T command can stop the system
@@ -24,6 +64,7 @@ void initialize_system ()
   initialize_timer ();
   initialize_cpu ();
   initialize_memory_manager ();
+  initialize_loader ();
   initialize_process_manager ();
 }
 
@@ -35,11 +76,18 @@ void main ()
   initialize_system ();
   start_terminal ();   // term.c
   start_swap_manager ();   // swap.c
+  start_pageout_daemon ();   // paging.c
+  start_cpu ();   // process.c
+  start_loaders ();   // submit.c
   process_admin_command ();   // admin.c
 
   // admin terminated the system, wait for other components to terminate
   //end_client_submission ();   // submit.c
+  end_loaders ();   // submit.c
+  end_cpu ();   // process.c
+  end_pageout_daemon ();   // paging.c
   end_terminal ();   // term.c
   end_swap_manager ();
+  end_replacement ();   // replace.c
 }
 
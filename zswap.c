@@ -0,0 +1,260 @@
+//==========================================================
+// zswap.c
+// A compressed swap tier in memory, in front of swap.disk: the pages
+// swap.c writes back are compressed into a pool of zswapKB KB, and a
+// later fault reads them back from it without a disk IO.  When the pool
+// is full, its least recently used pages are written to swap.disk
+// (spilled).  A pooled page is newer than its copy on swap.disk, so reads
+// take the pool copy over the disk one.
+// Pages are compressed by run-length encoding their words (a run is a
+// count byte and the word), which suits the zero filled and constant parts
+// of data pages; a page that does not get smaller is kept as it is.
+// The pool changes on the swap thread, and on the cpu thread when a
+// process ends, zmutex guards it
+//==========================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include "simos.h"
+
+typedef struct ZEntryStruct
+{ int pid, page;
+  int size;        // compressed bytes, pageBytes: kept as it is
+  unsigned char *data;
+  struct ZEntryStruct *hnext;          // hash chain
+  struct ZEntryStruct *lprev, *lnext;  // use order, least recent first
+  struct ZEntryStruct *pprev, *pnext;  // the pages of the same process
+} ZEntry;
+
+ZEntry **zHash;    // zHash[zHashSize], doubled when the pages outnumber it
+int zHashSize;
+ZEntry **zProc;    // zProc[pid]: the pooled pages of process pid
+ZEntry *zHead = NULL, *zTail = NULL;
+long zPoolBytes = 0, zPoolSize;
+int zNumPages = 0;
+int pageBytes;
+sem_t zmutex;
+int numZStores = 0, numZHits = 0, numZSpills = 0, numZRaw = 0;
+long zBytesIn = 0, zBytesOut = 0;   // of all stores, for the ratio
+
+//==========================================
+// compression
+//==========================================
+
+// returns the compressed size, pageBytes if it does not get smaller
+int zcompress (unsigned *page, unsigned char *out)
+{ int k = 0, run, size = 0;
+  int n = pageBytes / sizeof(unsigned);
+
+  while (k < n)
+  { run = 1;
+    while (k+run < n && run < 255 && page[k+run] == page[k]) run++;
+    if (size + 1 + sizeof(unsigned) >= pageBytes)
+    { memcpy (out, page, pageBytes); return (pageBytes); }
+    out[size] = run;
+    memcpy (out+size+1, &page[k], sizeof(unsigned));
+    size += 1 + sizeof(unsigned);
+    k += run;
+  }
+  return (size);
+}
+
+void zdecompress (ZEntry *e, unsigned *page)
+{ int i, k = 0, run;
+  unsigned word;
+
+  if (e->size == pageBytes) { memcpy (page, e->data, pageBytes); return; }
+  for (i = 0; i < e->size; i += 1 + sizeof(unsigned))
+  { memcpy (&word, e->data+i+1, sizeof(unsigned));
+    for (run = e->data[i]; run > 0; run--) page[k++] = word;
+  }
+}
+
+//==========================================
+// the pool, a hash table of the entries, which are also kept in use order
+// and in a list per process (dropped at once when the process ends)
+// zfind to zspill expect zmutex held
+//==========================================
+
+int zhash (int pid, int page)
+{ return ((((unsigned) pid * 2654435761u) ^ (unsigned) page) % zHashSize); }
+
+// compressed pages are small, the pool can hold many more pages than
+// zPoolSize/pageBytes, the chains are kept short by doubling the table
+void zgrow ()
+{ ZEntry **old = zHash, *e, *next;
+  int k, oldSize = zHashSize;
+
+  zHashSize = 2 * zHashSize;
+  zHash = (ZEntry **) calloc (zHashSize, sizeof(ZEntry *));
+  for (k = 0; k < oldSize; k++)
+    for (e = old[k]; e != NULL; e = next)
+    { next = e->hnext;
+      e->hnext = zHash[zhash (e->pid, e->page)];
+      zHash[zhash (e->pid, e->page)] = e;
+    }
+  free (old);
+}
+
+ZEntry *zfind (int pid, int page)
+{ ZEntry *e;
+
+  for (e = zHash[zhash (pid, page)]; e != NULL; e = e->hnext)
+    if (e->pid == pid && e->page == page) return (e);
+  return (NULL);
+}
+
+void zappend (ZEntry *e)
+{
+  e->lprev = zTail;
+  e->lnext = NULL;
+  if (zTail == NULL) zHead = e;
+  else zTail->lnext = e;
+  zTail = e;
+}
+
+void zunlist (ZEntry *e)
+{
+  if (e->lprev == NULL) zHead = e->lnext;
+  else e->lprev->lnext = e->lnext;
+  if (e->lnext == NULL) zTail = e->lprev;
+  else e->lnext->lprev = e->lprev;
+}
+
+void zremove (ZEntry *e)
+{ ZEntry **p = &zHash[zhash (e->pid, e->page)];
+
+  while (*p != e) p = &(*p)->hnext;
+  *p = e->hnext;
+  zunlist (e);
+  if (e->pprev == NULL) zProc[e->pid] = e->pnext;
+  else e->pprev->pnext = e->pnext;
+  if (e->pnext != NULL) e->pnext->pprev = e->pprev;
+  zPoolBytes -= e->size;
+  zNumPages--;
+  free (e->data);
+  free (e);
+}
+
+// the least recently used page goes to swap.disk
+void zspill ()
+{ unsigned *buf = (unsigned *) malloc (pageBytes);
+  ZEntry *e = zHead;
+
+  zdecompress (e, buf);
+  write_swap_pages (e->pid, e->page, buf, 1);
+  numZSpills++;
+  zremove (e);
+  free (buf);
+}
+
+// returns 1 if the page is in the pool now, 0: write it to swap.disk
+int zswap_store (int pid, int page, unsigned *buf)
+{ unsigned char *out;
+  ZEntry *e;
+
+  if (zswapKB == 0 || pageBytes > zPoolSize) return (0);
+  out = (unsigned char *) malloc (pageBytes);
+  e = (ZEntry *) malloc (sizeof(ZEntry));
+  e->pid = pid;
+  e->page = page;
+  e->size = zcompress (buf, out);
+  e->data = (unsigned char *) realloc (out, e->size);
+  sem_wait (&zmutex);
+  if (zfind (pid, page) != NULL) zremove (zfind (pid, page));
+  if (zNumPages >= zHashSize) zgrow ();
+  e->hnext = zHash[zhash (pid, page)];
+  zHash[zhash (pid, page)] = e;
+  zappend (e);
+  e->pprev = NULL;
+  e->pnext = zProc[pid];
+  if (e->pnext != NULL) e->pnext->pprev = e;
+  zProc[pid] = e;
+  zPoolBytes += e->size;
+  zNumPages++;
+  numZStores++;
+  if (e->size == pageBytes) numZRaw++;
+  zBytesIn += pageBytes;
+  zBytesOut += e->size;
+  while (zPoolBytes > zPoolSize) zspill ();
+  sem_post (&zmutex);
+  return (1);
+}
+
+// returns 1 if the page was in the pool, it is copied to buf
+int zswap_load (int pid, int page, unsigned *buf)
+{ ZEntry *e;
+
+  if (zswapKB == 0) return (0);
+  sem_wait (&zmutex);
+  e = zfind (pid, page);
+  if (e != NULL)
+  { zdecompress (e, buf);
+    zunlist (e);
+    zappend (e);
+    numZHits++;
+  }
+  sem_post (&zmutex);
+  return (e != NULL);
+}
+
+int zswap_has (int pid, int page)
+{ int found;
+
+  if (zswapKB == 0) return (0);
+  sem_wait (&zmutex);
+  found = (zfind (pid, page) != NULL);
+  sem_post (&zmutex);
+  return (found);
+}
+
+// the pages are written to swap.disk directly (a new process image)
+void zswap_invalidate (int pid, int page, int npages)
+{ ZEntry *e;
+  int k;
+
+  if (zswapKB == 0) return;
+  sem_wait (&zmutex);
+  for (k = page; k < page + npages; k++)
+  { e = zfind (pid, k);
+    if (e != NULL) zremove (e);
+  }
+  sem_post (&zmutex);
+}
+
+// process pid has ended, its pages are dropped, not spilled
+void zswap_drop_process (int pid)
+{
+  if (zswapKB == 0) return;
+  sem_wait (&zmutex);
+  while (zProc[pid] != NULL) zremove (zProc[pid]);
+  sem_post (&zmutex);
+}
+
+void dump_zswap ()
+{
+  printf ("******************** Compressed Swap Pool\n");
+  if (zswapKB == 0) { printf ("Off (zswapKB is 0)\n"); return; }
+  sem_wait (&zmutex);
+  printf ("%d pages in %ld of %ld bytes, %d stores (%d kept as is)\n",
+          zNumPages, zPoolBytes, zPoolSize, numZStores, numZRaw);
+  if (zBytesOut > 0)
+    printf ("Compression ratio %.2f (%ld bytes to %ld)\n",
+            (double) zBytesIn / zBytesOut, zBytesIn, zBytesOut);
+  printf ("%d pages read from the pool, %d spilled to swap.disk\n",
+          numZHits, numZSpills);
+  sem_post (&zmutex);
+}
+
+void initialize_zswap ()
+{
+  pageBytes = pageSize * dataSize;
+  zPoolSize = (long) zswapKB * 1024;
+  // a slot per page the pool holds uncompressed to start with
+  zHashSize = 1;
+  while (zHashSize < zPoolSize / pageBytes) zHashSize *= 2;
+  zHash = (ZEntry **) calloc (zHashSize, sizeof(ZEntry *));
+  zProc = (ZEntry **) calloc (maxProcess, sizeof(ZEntry *));
+  sem_init (&zmutex, 0, 1);
+}